@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Cache-line / page heatmap of the main image's non-stack loads and stores.
+ *
+ *  Every access is split into 64-byte lines. Per line: loads, stores, which bytes
+ *  were touched and the reuse distance (distinct lines accessed in between, exact,
+ *  Fenwick tree over last-access stamps). Per 4 KB page: accesses and lines touched.
+ *  malloc/calloc/realloc/free are wrapped with RTN_InsertCall so every allocation gets
+ *  its share of bytes touched and of fetched line bytes actually used (e.g. struct
+ *  cell, 24 bytes). A realloc that moves the block frees the old one.
+ *
+ *  One lock guards all of it: the reuse distance is defined over the single, global
+ *  order of accesses, which per-thread tables could not give.
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <unordered_map>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "cs6501_replay.h"
+#include "cs6501_stack.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+ADDRINT g_addrLow, g_addrHigh;
+BOOL g_bMainExecLoaded = FALSE;
+
+#define LINE_SIZE 64
+#define PAGE_SIZE_4K 4096
+#define LINE_OF(a) ((a) & ~(ADDRINT)(LINE_SIZE - 1))
+#define PAGE_OF(a) ((a) & ~(ADDRINT)(PAGE_SIZE_4K - 1))
+
+struct LINE_STAT {
+    UINT64 loads, stores;
+    UINT64 touched;         // byte mask, whole run
+    UINT64 allocTouched;    // byte mask since the allocation covering the line was made
+    UINT64 last;            // reuse-tree slot of the last access, 0 = never accessed
+    UINT64 reuses, reuseSum, reuseMax;
+};
+
+struct PAGE_STAT {
+    UINT64 accesses;
+    UINT64 lines;           // one bit per line of the page
+};
+
+struct ALLOC {
+    ADDRINT base, size;
+    ADDRINT site;           // caller offset in the main image, or ~0 for libraries
+    BOOL freed;
+    UINT64 bytesTouched;    // filled when freed / at Fini
+    UINT64 linesTouched;
+};
+
+struct SITE_STAT {
+    UINT64 allocs, bytes, bytesTouched, linesTouched;
+};
+
+unordered_map<ADDRINT, LINE_STAT> g_lines;
+unordered_map<ADDRINT, PAGE_STAT> g_pages;
+vector<ALLOC> g_allocs;
+map<ADDRINT, size_t> g_liveAllocs;              // base -> index into g_allocs
+PIN_LOCK g_heatLock;                            // guards everything above and the reuse tree
+
+// Allocator call in progress, per thread. Only the outermost one counts: glibc's
+// realloc(0, n) runs malloc, and realloc(p, 0) runs free.
+struct ALLOC_CALL {
+    ADDRINT size, site;
+    ADDRINT old;            // block being reallocated, 0 for malloc / calloc
+    UINT32 depth;
+};
+ALLOC_CALL g_allocCall[PIN_MAX_THREADS];
+
+// Reuse tree: one mark per line at its last-access slot. The number of marks
+// between two accesses to a line is its reuse distance.
+vector<INT32> g_reuseTree;
+UINT64 g_reuseNow = 1;
+
+FILE* g_fpOut = 0;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutput(KNOB_MODE_WRITEONCE, "pintool", "o", "heatmap.txt",
+    "report file");
+KNOB<UINT32> KnobTop(KNOB_MODE_WRITEONCE, "pintool", "top", "30",
+    "lines, pages and allocations per report section (0: all)");
+KNOB<BOOL> KnobAllocAll(KNOB_MODE_WRITEONCE, "pintool", "alloc_all", "0",
+    "also report allocations made from libraries (ncurses, libc)");
+KNOB<UINT32> KnobReuseSlots(KNOB_MODE_WRITEONCE, "pintool", "reuse_slots", "1048576",
+    "reuse tree size; the tree is compacted when it fills up");
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool writes a cache-line / page heatmap of the main image's memory accesses.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Reuse Distance */
+/* ===================================================================== */
+
+VOID ReuseAdd(UINT64 slot, INT32 delta)
+{
+    for (; slot < g_reuseTree.size(); slot += slot & (~slot + 1)) g_reuseTree[slot] += delta;
+}
+
+INT64 ReusePrefix(UINT64 slot)
+{
+    INT64 sum = 0;
+    for (; slot > 0; slot -= slot & (~slot + 1)) sum += g_reuseTree[slot];
+    return sum;
+}
+
+bool CompareLast(const LINE_STAT* a, const LINE_STAT* b) { return a->last < b->last; }
+
+// Renumbers the live marks 1..k in access order so the stamps fit the tree again.
+VOID ReuseCompact()
+{
+    vector<LINE_STAT*> live;
+    for (unordered_map<ADDRINT, LINE_STAT>::iterator it = g_lines.begin(); it != g_lines.end(); ++it) {
+        if (it->second.last) live.push_back(&it->second);
+    }
+    sort(live.begin(), live.end(), CompareLast);
+
+    size_t slots = g_reuseTree.size() - 1;
+    while (live.size() * 2 > slots) slots *= 2;
+    g_reuseTree.assign(slots + 1, 0);
+    for (size_t i = 0; i < live.size(); i++) {
+        live[i]->last = i + 1;
+        ReuseAdd(i + 1, 1);
+    }
+    g_reuseNow = live.size() + 1;
+}
+
+VOID ReuseTouch(LINE_STAT& l)
+{
+    if (l.last) {
+        UINT64 dist = ReusePrefix(g_reuseNow - 1) - ReusePrefix(l.last);
+        ReuseAdd(l.last, -1);
+        l.reuses++;
+        l.reuseSum += dist;
+        l.reuseMax = max(l.reuseMax, dist);
+    }
+    if (g_reuseNow >= g_reuseTree.size()) {
+        if (l.last) l.last = 0;     // already unmarked, keep it out of the compaction
+        ReuseCompact();
+    }
+    l.last = g_reuseNow++;
+    ReuseAdd(l.last, 1);
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+VOID RecordAccess(THREADID tid, ADDRINT ea, UINT32 size, BOOL isStore)
+{
+    PIN_GetLock(&g_heatLock, tid + 1);
+    for (ADDRINT a = ea, end = ea + size; a < end; a = LINE_OF(a) + LINE_SIZE) {
+        ADDRINT line = LINE_OF(a);
+        UINT32 first = a - line;
+        UINT32 n = (UINT32)min<ADDRINT>(end - a, LINE_SIZE - first);
+        UINT64 mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << first;
+
+        LINE_STAT& l = g_lines[line];
+        if (isStore) l.stores++; else l.loads++;
+        l.touched |= mask;
+        l.allocTouched |= mask;
+        ReuseTouch(l);
+
+        PAGE_STAT& p = g_pages[PAGE_OF(line)];
+        p.accesses++;
+        p.lines |= 1ULL << ((line % PAGE_SIZE_4K) / LINE_SIZE);
+    }
+    PIN_ReleaseLock(&g_heatLock);
+}
+
+VOID AllocEnter(THREADID tid, ADDRINT size, ADDRINT old, ADDRINT retIp)
+{
+    ALLOC_CALL& c = g_allocCall[tid];
+    if (c.depth++) return;
+    c.size = size;
+    c.old = old;
+    c.site = (g_addrLow <= retIp && retIp < g_addrHigh) ? retIp - g_addrLow : ~(ADDRINT)0;
+}
+
+VOID MallocBefore(THREADID tid, ADDRINT size, ADDRINT retIp) { AllocEnter(tid, size, 0, retIp); }
+
+VOID CallocBefore(THREADID tid, ADDRINT count, ADDRINT size, ADDRINT retIp) { AllocEnter(tid, count * size, 0, retIp); }
+
+VOID ReallocBefore(THREADID tid, ADDRINT old, ADDRINT size, ADDRINT retIp) { AllocEnter(tid, size, old, retIp); }
+
+// Bytes of [base, base+size) touched since the allocation, and lines with any of them.
+VOID AllocUsage(ALLOC& a)
+{
+    a.bytesTouched = a.linesTouched = 0;
+    for (ADDRINT line = LINE_OF(a.base); line < a.base + a.size; line += LINE_SIZE) {
+        unordered_map<ADDRINT, LINE_STAT>::iterator it = g_lines.find(line);
+        if (it == g_lines.end()) continue;
+
+        UINT64 mask = ~0ULL;
+        if (line < a.base) mask &= ~0ULL << (a.base - line);
+        if (line + LINE_SIZE > a.base + a.size) mask &= ~0ULL >> (line + LINE_SIZE - a.base - a.size);
+        UINT64 used = it->second.allocTouched & mask;
+        a.bytesTouched += __builtin_popcountll(used);
+        a.linesTouched += used != 0;
+    }
+}
+
+// Closes the usage of a live block; call with g_heatLock held.
+VOID AllocRelease(ADDRINT base)
+{
+    map<ADDRINT, size_t>::iterator it = g_liveAllocs.find(base);
+    if (it != g_liveAllocs.end()) {
+        ALLOC& a = g_allocs[it->second];
+        AllocUsage(a);
+        a.freed = TRUE;
+        g_liveAllocs.erase(it);
+    }
+}
+
+VOID AllocAfter(THREADID tid, ADDRINT base)
+{
+    ALLOC_CALL& c = g_allocCall[tid];
+    if (c.depth == 0 || --c.depth) return;
+
+    if (c.old) {
+        PIN_GetLock(&g_heatLock, tid + 1);
+        map<ADDRINT, size_t>::iterator it = g_liveAllocs.find(c.old);
+        if (base == c.old && it != g_liveAllocs.end()) {
+            g_allocs[it->second].size = c.size;     // resized in place: same block
+            PIN_ReleaseLock(&g_heatLock);
+            return;
+        }
+        // Moved, or realloc(p, 0) freed it; a failed realloc leaves p alive
+        if (base != 0 || c.size == 0) AllocRelease(c.old);
+        PIN_ReleaseLock(&g_heatLock);
+    }
+    if (base == 0) return;
+    if (c.site == ~(ADDRINT)0 && !KnobAllocAll.Value()) return;
+
+    ALLOC a = { base, c.size, c.site, FALSE, 0, 0 };
+    PIN_GetLock(&g_heatLock, tid + 1);
+    // Earlier owners of this memory do not count toward the new allocation
+    for (ADDRINT line = LINE_OF(base); line < base + a.size; line += LINE_SIZE) {
+        unordered_map<ADDRINT, LINE_STAT>::iterator it = g_lines.find(line);
+        if (it != g_lines.end()) it->second.allocTouched = 0;
+    }
+    g_liveAllocs[base] = g_allocs.size();
+    g_allocs.push_back(a);
+    PIN_ReleaseLock(&g_heatLock);
+}
+
+VOID FreeBefore(THREADID tid, ADDRINT base)
+{
+    if (g_allocCall[tid].depth) return;     // inside realloc, handled by AllocAfter
+    PIN_GetLock(&g_heatLock, tid + 1);
+    AllocRelease(base);
+    PIN_ReleaseLock(&g_heatLock);
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if( IMG_IsMainExecutable(img) ) {
+        g_addrLow = IMG_LowAddress(img); 
+        g_addrHigh = IMG_HighAddress(img);
+        g_bMainExecLoaded = TRUE;
+        return;
+    }
+
+    RTN mallocRtn = RTN_FindByName(img, "malloc");
+    if (RTN_Valid(mallocRtn)) {
+        RTN_Open(mallocRtn);
+        RTN_InsertCall(mallocRtn, IPOINT_BEFORE, (AFUNPTR)MallocBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_RETURN_IP, IARG_END);
+        RTN_InsertCall(mallocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+            IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        RTN_Close(mallocRtn);
+    }
+
+    RTN callocRtn = RTN_FindByName(img, "calloc");
+    if (RTN_Valid(callocRtn)) {
+        RTN_Open(callocRtn);
+        RTN_InsertCall(callocRtn, IPOINT_BEFORE, (AFUNPTR)CallocBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+            IARG_RETURN_IP, IARG_END);
+        RTN_InsertCall(callocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+            IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        RTN_Close(callocRtn);
+    }
+
+    RTN reallocRtn = RTN_FindByName(img, "realloc");
+    if (RTN_Valid(reallocRtn)) {
+        RTN_Open(reallocRtn);
+        RTN_InsertCall(reallocRtn, IPOINT_BEFORE, (AFUNPTR)ReallocBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+            IARG_RETURN_IP, IARG_END);
+        RTN_InsertCall(reallocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+            IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        RTN_Close(reallocRtn);
+    }
+
+    RTN freeRtn = RTN_FindByName(img, "free");
+    if (RTN_Valid(freeRtn)) {
+        RTN_Open(freeRtn);
+        RTN_InsertCall(freeRtn, IPOINT_BEFORE, (AFUNPTR)FreeBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        RTN_Close(freeRtn);
+    }
+}
+
+VOID Instruction(INS ins, VOID* v)
+{
+    ADDRINT addr = INS_Address(ins);
+    if (!g_bMainExecLoaded || addr < g_addrLow || addr >= g_addrHigh) return;
+
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        UINT32 size = INS_MemoryOperandSize(ins, memOp);
+        // read-modify-write operands count once as a load and once as a store
+        for (int isStore = 0; isStore < 2; isStore++) {
+            if (isStore ? !INS_MemoryOperandIsWritten(ins, memOp) : !INS_MemoryOperandIsRead(ins, memOp)) continue;
+
+            Stack_InsertIfCall(ins, IPOINT_BEFORE, memOp);
+            INS_InsertThenCall(
+                ins, IPOINT_BEFORE, (AFUNPTR)RecordAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYOP_EA, memOp,
+                IARG_UINT32, size,
+                IARG_BOOL, isStore,
+                IARG_END);
+        }
+    }
+}
+
+/* ===================================================================== */
+/* Report */
+/* ===================================================================== */
+
+template <class T> size_t TopN(vector<T>& v)
+{
+    return KnobTop.Value() ? min<size_t>(KnobTop.Value(), v.size()) : v.size();
+}
+
+VOID Fini(INT32 code, VOID* v)
+{
+    FILE* fp = g_fpOut;
+
+    // Allocations: per call site, then the biggest single ones
+    map<ADDRINT, SITE_STAT> sites;
+    vector<pair<ADDRINT, size_t> > bySize;
+    for (size_t i = 0; i < g_allocs.size(); i++) {
+        ALLOC& a = g_allocs[i];
+        if (!a.freed) AllocUsage(a);
+        SITE_STAT& s = sites[a.site];
+        s.allocs++;
+        s.bytes += a.size;
+        s.bytesTouched += a.bytesTouched;
+        s.linesTouched += a.linesTouched;
+        bySize.push_back(make_pair(a.size, i));
+    }
+
+    fprintf(fp, "[ALLOC SITES] site, allocs, bytes, bytes touched (%%), line bytes used (%%)\n");
+    for (map<ADDRINT, SITE_STAT>::iterator it = sites.begin(); it != sites.end(); ++it) {
+        const SITE_STAT& s = it->second;
+        fprintf(fp, "site: %lx, allocs: %llu, bytes: %llu, touched: %llu (%.1f%%), line use: %.1f%%\n",
+            it->first, (unsigned long long)s.allocs, (unsigned long long)s.bytes, (unsigned long long)s.bytesTouched,
+            s.bytes ? 100.0 * s.bytesTouched / s.bytes : 0.0,
+            s.linesTouched ? 100.0 * s.bytesTouched / (s.linesTouched * LINE_SIZE) : 0.0);
+    }
+
+    size_t n = TopN(bySize);
+    partial_sort(bySize.begin(), bySize.begin() + n, bySize.end(), greater<pair<ADDRINT, size_t> >());
+    fprintf(fp, "\n[ALLOCS] top %lu of %lu by size\n", (unsigned long)n, (unsigned long)bySize.size());
+    for (size_t i = 0; i < n; i++) {
+        const ALLOC& a = g_allocs[bySize[i].second];
+        fprintf(fp, "mem: %p (sz: %lu) site: %lx%s, touched: %llu (%.1f%%), lines touched: %llu, line use: %.1f%%\n",
+            (VOID*)a.base, a.size, a.site, a.freed ? " (freed)" : "", (unsigned long long)a.bytesTouched,
+            a.size ? 100.0 * a.bytesTouched / a.size : 0.0, (unsigned long long)a.linesTouched,
+            a.linesTouched ? 100.0 * a.bytesTouched / (a.linesTouched * LINE_SIZE) : 0.0);
+    }
+
+    // Lines, hottest first
+    vector<pair<UINT64, ADDRINT> > hot;
+    for (unordered_map<ADDRINT, LINE_STAT>::iterator it = g_lines.begin(); it != g_lines.end(); ++it) {
+        hot.push_back(make_pair(it->second.loads + it->second.stores, it->first));
+    }
+    n = TopN(hot);
+    partial_sort(hot.begin(), hot.begin() + n, hot.end(), greater<pair<UINT64, ADDRINT> >());
+    fprintf(fp, "\n[LINES] top %lu of %lu by accesses\n", (unsigned long)n, (unsigned long)hot.size());
+    for (size_t i = 0; i < n; i++) {
+        const LINE_STAT& l = g_lines[hot[i].second];
+        fprintf(fp, "line: %p loads: %llu stores: %llu bytes: %d/64 reuse: %llu (mean %.1f, max %llu)\n",
+            (VOID*)hot[i].second, (unsigned long long)l.loads, (unsigned long long)l.stores,
+            __builtin_popcountll(l.touched), (unsigned long long)l.reuses,
+            l.reuses ? (double)l.reuseSum / l.reuses : 0.0, (unsigned long long)l.reuseMax);
+    }
+
+    // Pages, hottest first
+    hot.clear();
+    for (unordered_map<ADDRINT, PAGE_STAT>::iterator it = g_pages.begin(); it != g_pages.end(); ++it) {
+        hot.push_back(make_pair(it->second.accesses, it->first));
+    }
+    n = TopN(hot);
+    partial_sort(hot.begin(), hot.begin() + n, hot.end(), greater<pair<UINT64, ADDRINT> >());
+    fprintf(fp, "\n[PAGES] top %lu of %lu by accesses\n", (unsigned long)n, (unsigned long)hot.size());
+    for (size_t i = 0; i < n; i++) {
+        const PAGE_STAT& p = g_pages[hot[i].second];
+        UINT64 bytes = 0;
+        for (UINT32 j = 0; j < PAGE_SIZE_4K / LINE_SIZE; j++) {
+            if (p.lines & (1ULL << j)) bytes += __builtin_popcountll(g_lines[hot[i].second + j * LINE_SIZE].touched);
+        }
+        fprintf(fp, "page: %p accesses: %llu lines: %d/64 bytes: %llu/4096\n", (VOID*)hot[i].second,
+            (unsigned long long)p.accesses, __builtin_popcountll(p.lines), (unsigned long long)bytes);
+    }
+    fclose(fp);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+    if (!Replay_Init() || !Stack_Init())
+    {
+        return Usage();
+    }
+
+    g_fpOut = fopen(KnobOutput.Value().c_str(), "wt");
+    PIN_InitLock(&g_heatLock);
+    g_reuseTree.assign(max<UINT32>(KnobReuseSlots.Value(), 16) + 1, 0);
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Struct / array layout recovery from the main image's non-stack stores.
+ *
+ *  Each store site runs a stride predictor in its analysis routine, the state
+ *  machine of a reference prediction table (a stride prefetcher): last address,
+ *  stride, and INITIAL / TRANSIENT / STEADY / NOPRED. A streak of correctly
+ *  predicted strides is a run, [first, last] with one stride; a site keeps at most
+ *  LAYOUT_RUNS of them, so memory per site is fixed however long the game runs.
+ *
+ *  At Fini the runs of all sites are grouped into arrays (overlapping address
+ *  ranges, or the same malloc block: malloc/free are wrapped as in heatmap).
+ *  The element size is the gcd of the strides in a group, the field offset of a
+ *  site is (first - base) % element size, and every array is printed as a C
+ *  struct: offset 0x1616 of mine, 4-byte stores 0x18 apart, comes out as the
+ *  `is_mine` field at +0x8 of a 24-byte struct cell.
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include "cs6501_replay.h"
+#include "cs6501_stack.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+ADDRINT g_addrLow, g_addrHigh;
+BOOL g_bMainExecLoaded = FALSE;
+
+#define LAYOUT_RUNS 8               // runs kept per store site
+
+enum STRIDE_STATE { STRIDE_INITIAL, STRIDE_TRANSIENT, STRIDE_STEADY, STRIDE_NOPRED };
+
+// A streak of stores [first, last] (first <= last) stride bytes apart.
+struct LAYOUT_RUN {
+    ADDRINT first, last;
+    INT64 stride;
+    UINT64 stores;
+};
+
+struct LAYOUT_SITE {
+    ADDRINT offset;
+    UINT32 size;                    // store size in bytes
+    // predictor
+    ADDRINT prev, prev2;            // last two store addresses
+    INT64 stride;
+    STRIDE_STATE state;
+    UINT64 stores, correct;
+    // current run: starts at runFirst, runLen stores so far
+    ADDRINT runFirst;
+    UINT64 runLen;
+    LAYOUT_RUN runs[LAYOUT_RUNS];
+    UINT32 numRuns;
+    UINT64 runsDropped;
+};
+
+struct LAYOUT_ALLOC {
+    ADDRINT base, size;
+    ADDRINT site;                   // caller offset in the main image, or ~0 for libraries
+};
+
+map<pair<ADDRINT, UINT32>, LAYOUT_SITE*> g_sites;   // (offset, memory operand) -> site
+map<ADDRINT, LAYOUT_ALLOC> g_liveAllocs;        // base -> allocation
+vector<LAYOUT_ALLOC> g_freedAllocs;             // blocks a run was found in before free()
+PIN_LOCK g_allocLock;                           // guards the three above (FreeBefore walks g_sites)
+ADDRINT g_mallocSize[PIN_MAX_THREADS];
+ADDRINT g_mallocSite[PIN_MAX_THREADS];
+
+UINT64 g_minRun;
+ADDRINT g_maxStride;
+
+FILE* g_fpOut = 0;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutput(KNOB_MODE_WRITEONCE, "pintool", "o", "layout.txt",
+    "report file");
+KNOB<UINT32> KnobMinRun(KNOB_MODE_WRITEONCE, "pintool", "min_run", "4",
+    "stores a run needs before it counts as an array walk");
+KNOB<UINT32> KnobMaxStride(KNOB_MODE_WRITEONCE, "pintool", "max_stride", "4096",
+    "larger strides are not taken as array elements");
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool recovers array and struct layouts from the strides of the main image's stores.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Run Table */
+/* ===================================================================== */
+
+static ADDRINT AbsStride(INT64 stride) { return stride < 0 ? -stride : stride; }
+
+// Same stride, same phase, and the two ranges overlap or are one stride apart.
+static BOOL RunsJoin(const LAYOUT_RUN& a, const LAYOUT_RUN& b)
+{
+    ADDRINT s = AbsStride(a.stride);
+    if (a.stride != b.stride || (INT64)(a.first - b.first) % (INT64)s) return FALSE;
+    return a.first <= b.last + s && b.first <= a.last + s;
+}
+
+// Files a finished run into the site's table, merging it into a run of the same
+// walk (the board re-initialized) or evicting the shortest one when full.
+static VOID RunClose(LAYOUT_SITE* site, ADDRINT last)
+{
+    LAYOUT_RUN r;
+    r.first = min(site->runFirst, last);
+    r.last = max(site->runFirst, last);
+    r.stride = site->stride;
+    r.stores = site->runLen;
+    site->runLen = 0;
+    if (r.stores < g_minRun) return;
+
+    for (UINT32 i = 0; i < site->numRuns; i++) {
+        LAYOUT_RUN& o = site->runs[i];
+        if (!RunsJoin(o, r)) continue;
+        o.first = min(o.first, r.first);
+        o.last = max(o.last, r.last);
+        o.stores += r.stores;
+        return;
+    }
+    if (site->numRuns < LAYOUT_RUNS) {
+        site->runs[site->numRuns++] = r;
+        return;
+    }
+    UINT32 shortest = 0;
+    for (UINT32 i = 1; i < LAYOUT_RUNS; i++) {
+        if (site->runs[i].stores < site->runs[shortest].stores) shortest = i;
+    }
+    site->runsDropped++;
+    if (site->runs[shortest].stores < r.stores) site->runs[shortest] = r;
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+// One step of the reference prediction table for this store site.
+VOID RecordStore(LAYOUT_SITE* site, ADDRINT ea)
+{
+    if (site->stores++ == 0) {
+        site->prev = ea;
+        return;
+    }
+
+    INT64 delta = (INT64)(ea - site->prev);
+    BOOL hit = delta == site->stride && delta != 0 && AbsStride(delta) <= g_maxStride;
+    if (hit) {
+        site->correct++;
+        if (site->runLen == 0) {
+            // the store the stride was learned from belongs to the run too
+            BOOL learned = site->stores > 2 && site->prev - site->prev2 == (ADDRINT)delta;
+            site->runFirst = learned ? site->prev2 : site->prev;
+            site->runLen = learned ? 2 : 1;
+        }
+        site->runLen++;
+    }
+    else if (site->runLen) {
+        RunClose(site, site->prev);
+    }
+
+    switch (site->state) {
+    case STRIDE_INITIAL:
+        if (hit) site->state = STRIDE_STEADY;
+        else { site->state = STRIDE_TRANSIENT; site->stride = delta; }
+        break;
+    case STRIDE_TRANSIENT:
+        if (hit) site->state = STRIDE_STEADY;
+        else { site->state = STRIDE_NOPRED; site->stride = delta; }
+        break;
+    case STRIDE_STEADY:
+        // one miss (end of a row, a skipped element) keeps the stride
+        if (!hit) site->state = STRIDE_INITIAL;
+        break;
+    case STRIDE_NOPRED:
+        if (hit) site->state = STRIDE_TRANSIENT;
+        else site->stride = delta;
+        break;
+    }
+    site->prev2 = site->prev;
+    site->prev = ea;
+}
+
+VOID MallocBefore(THREADID tid, ADDRINT size, ADDRINT retIp)
+{
+    g_mallocSize[tid] = size;
+    g_mallocSite[tid] = (g_addrLow <= retIp && retIp < g_addrHigh) ? retIp - g_addrLow : ~(ADDRINT)0;
+}
+
+VOID MallocAfter(THREADID tid, ADDRINT base)
+{
+    if (base == 0 || g_mallocSite[tid] == ~(ADDRINT)0) return;     // ncurses / libc internals
+    LAYOUT_ALLOC a = { base, g_mallocSize[tid], g_mallocSite[tid] };
+    PIN_GetLock(&g_allocLock, tid + 1);
+    g_liveAllocs[base] = a;
+    PIN_ReleaseLock(&g_allocLock);
+}
+
+// A block that holds a run stays known after free(), so the report still finds its base.
+VOID FreeBefore(THREADID tid, ADDRINT base)
+{
+    PIN_GetLock(&g_allocLock, tid + 1);
+    map<ADDRINT, LAYOUT_ALLOC>::iterator it = g_liveAllocs.find(base);
+    if (it != g_liveAllocs.end()) {
+        const LAYOUT_ALLOC& a = it->second;
+        BOOL used = FALSE;
+        for (map<pair<ADDRINT, UINT32>, LAYOUT_SITE*>::iterator si = g_sites.begin(); si != g_sites.end() && !used; ++si) {
+            const LAYOUT_SITE* s = si->second;
+            for (UINT32 r = 0; r < s->numRuns && !used; r++) {
+                used = a.base <= s->runs[r].first && s->runs[r].first < a.base + a.size;
+            }
+            used = used || (s->runLen && a.base <= s->runFirst && s->runFirst < a.base + a.size);
+        }
+        if (used) g_freedAllocs.push_back(a);
+        g_liveAllocs.erase(it);
+    }
+    PIN_ReleaseLock(&g_allocLock);
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if( IMG_IsMainExecutable(img) ) {
+        g_addrLow = IMG_LowAddress(img);
+        g_addrHigh = IMG_HighAddress(img);
+        g_bMainExecLoaded = TRUE;
+        return;
+    }
+
+    RTN mallocRtn = RTN_FindByName(img, "malloc");
+    if (RTN_Valid(mallocRtn)) {
+        RTN_Open(mallocRtn);
+        RTN_InsertCall(mallocRtn, IPOINT_BEFORE, (AFUNPTR)MallocBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_RETURN_IP, IARG_END);
+        RTN_InsertCall(mallocRtn, IPOINT_AFTER, (AFUNPTR)MallocAfter,
+            IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        RTN_Close(mallocRtn);
+    }
+
+    RTN freeRtn = RTN_FindByName(img, "free");
+    if (RTN_Valid(freeRtn)) {
+        RTN_Open(freeRtn);
+        RTN_InsertCall(freeRtn, IPOINT_BEFORE, (AFUNPTR)FreeBefore,
+            IARG_THREAD_ID, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        RTN_Close(freeRtn);
+    }
+}
+
+VOID Instruction(INS ins, VOID* v)
+{
+    ADDRINT addr = INS_Address(ins);
+    if (!g_bMainExecLoaded || addr < g_addrLow || addr >= g_addrHigh) return;
+
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (!INS_MemoryOperandIsWritten(ins, memOp) || INS_OperandIsImplicit(ins, memOp)) continue;
+
+        // One predictor per site, like one RPT entry per PC; a trace that is
+        // instrumented again finds its site already there.
+        PIN_GetLock(&g_allocLock, PIN_ThreadId() + 1);
+        LAYOUT_SITE*& slot = g_sites[make_pair(addr - g_addrLow, memOp)];
+        if (slot == 0) {
+            slot = new LAYOUT_SITE();
+            slot->offset = addr - g_addrLow;
+            slot->size = INS_MemoryOperandSize(ins, memOp);
+            slot->state = STRIDE_INITIAL;
+        }
+        LAYOUT_SITE* site = slot;
+        PIN_ReleaseLock(&g_allocLock);
+
+        Stack_InsertIfCall(ins, IPOINT_BEFORE, memOp);
+        INS_InsertThenCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)RecordStore,
+            IARG_PTR, site,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_END);
+    }
+}
+
+/* ===================================================================== */
+/* Report */
+/* ===================================================================== */
+
+struct LAYOUT_GROUP_RUN {
+    const LAYOUT_SITE* site;
+    LAYOUT_RUN run;
+};
+
+bool CompareFirst(const LAYOUT_GROUP_RUN& a, const LAYOUT_GROUP_RUN& b) { return a.run.first < b.run.first; }
+
+static ADDRINT Gcd(ADDRINT a, ADDRINT b) { return b ? Gcd(b, a % b) : a; }
+
+static const LAYOUT_ALLOC* FindAlloc(ADDRINT addr)
+{
+    map<ADDRINT, LAYOUT_ALLOC>::iterator it = g_liveAllocs.upper_bound(addr);
+    if (it != g_liveAllocs.begin()) {
+        --it;
+        if (addr < it->second.base + it->second.size) return &it->second;
+    }
+    for (size_t i = g_freedAllocs.size(); i-- > 0;) {
+        if (g_freedAllocs[i].base <= addr && addr < g_freedAllocs[i].base + g_freedAllocs[i].size) return &g_freedAllocs[i];
+    }
+    return 0;
+}
+
+static const char* FieldType(UINT32 size)
+{
+    switch (size) {
+    case 1: return "char";
+    case 2: return "short";
+    case 4: return "int";
+    case 8: return "long";
+    default: return 0;
+    }
+}
+
+struct LAYOUT_FIELD {
+    UINT32 size;
+    UINT64 stores;
+    set<ADDRINT> sites;
+};
+
+// Prints one array: its base, element size and the recovered struct.
+static VOID ReportArray(FILE* fp, UINT32 id, const vector<LAYOUT_GROUP_RUN>& group)
+{
+    ADDRINT elem = 0, lowest = ~(ADDRINT)0, highest = 0;
+    for (size_t i = 0; i < group.size(); i++) {
+        elem = Gcd(elem, AbsStride(group[i].run.stride));
+        lowest = min(lowest, group[i].run.first);
+        highest = max(highest, group[i].run.last + group[i].site->size);
+    }
+
+    // Heap arrays start at their block; otherwise at the lowest store, so
+    // offsets are relative to the first field that was written.
+    const LAYOUT_ALLOC* alloc = FindAlloc(lowest);
+    ADDRINT base = alloc ? alloc->base : lowest;
+
+    map<ADDRINT, LAYOUT_FIELD> fields;      // offset in the element -> field
+    for (size_t i = 0; i < group.size(); i++) {
+        LAYOUT_FIELD& f = fields[(group[i].run.first - base) % elem];
+        f.size = max(f.size, group[i].site->size);
+        f.stores += group[i].run.stores;
+        f.sites.insert(group[i].site->offset);
+    }
+
+    fprintf(fp, "array %u: %p, element 0x%lx bytes, elements %lu..%lu written", id, (VOID*)base, elem,
+        (lowest - base) / elem, (highest - 1 - base) / elem);
+    if (alloc) {
+        fprintf(fp, " (heap: %lu bytes = %lu elements", alloc->size, alloc->size / elem);
+        if (alloc->site != ~(ADDRINT)0) fprintf(fp, ", malloc at %lx", alloc->site);
+        fprintf(fp, ")");
+    }
+    else if (g_addrLow <= base && base < g_addrHigh) {
+        fprintf(fp, " (image +%lx)", base - g_addrLow);
+    }
+    fprintf(fp, "\n");
+
+    fprintf(fp, "struct array%u_elem {    // 0x%lx bytes\n", id, elem);
+    ADDRINT at = 0;
+    for (map<ADDRINT, LAYOUT_FIELD>::iterator it = fields.begin(); it != fields.end(); ++it) {
+        const LAYOUT_FIELD& f = it->second;
+        if (it->first < at) {
+            fprintf(fp, "    // also %u bytes at +0x%lx", f.size, it->first);
+        }
+        else {
+            if (it->first > at) fprintf(fp, "    char pad_%lx[%lu];\n", at, it->first - at);
+            const char* type = FieldType(f.size);
+            if (type) fprintf(fp, "    %s f_%lx;", type, it->first);
+            else fprintf(fp, "    char f_%lx[%u];", it->first, f.size);
+            at = it->first + f.size;
+        }
+        fprintf(fp, "    // +0x%lx, %llu stores, sites", it->first, (unsigned long long)f.stores);
+        for (set<ADDRINT>::const_iterator s = f.sites.begin(); s != f.sites.end(); ++s) fprintf(fp, " %lx", *s);
+        fprintf(fp, "\n");
+    }
+    if (at < elem) fprintf(fp, "    char pad_%lx[%lu];\n", at, elem - at);
+    fprintf(fp, "};\n\n");
+}
+
+VOID Fini(INT32 code, VOID* v)
+{
+    FILE* fp = g_fpOut;
+
+    // Runs still open at exit count like closed ones
+    vector<LAYOUT_GROUP_RUN> runs;
+    for (map<pair<ADDRINT, UINT32>, LAYOUT_SITE*>::iterator it = g_sites.begin(); it != g_sites.end(); ++it) {
+        LAYOUT_SITE* s = it->second;
+        if (s->runLen) RunClose(s, s->prev);
+        for (UINT32 r = 0; r < s->numRuns; r++) {
+            LAYOUT_GROUP_RUN g = { s, s->runs[r] };
+            runs.push_back(g);
+        }
+    }
+
+    // Arrays: runs whose [first, last + size) ranges overlap, or that lie in the same heap block
+    sort(runs.begin(), runs.end(), CompareFirst);
+    vector<vector<LAYOUT_GROUP_RUN> > arrays;
+    ADDRINT groupEnd = 0;
+    const LAYOUT_ALLOC* groupAlloc = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+        const LAYOUT_ALLOC* alloc = FindAlloc(runs[i].run.first);
+        if (arrays.empty() || (runs[i].run.first >= groupEnd && (alloc == 0 || alloc != groupAlloc))) {
+            arrays.push_back(vector<LAYOUT_GROUP_RUN>());
+            groupAlloc = alloc;
+            groupEnd = 0;
+        }
+        arrays.back().push_back(runs[i]);
+        groupEnd = max(groupEnd, runs[i].run.last + runs[i].site->size);
+    }
+
+    fprintf(fp, "[ARRAYS] %lu arrays from %lu strided runs\n\n", (unsigned long)arrays.size(), (unsigned long)runs.size());
+    for (size_t i = 0; i < arrays.size(); i++) {
+        ReportArray(fp, i, arrays[i]);
+    }
+
+    fprintf(fp, "[SITES] store sites with strided runs\n");
+    fprintf(fp, "# site, size, stores, predicted (%%), runs: [first, last] stride x stores\n");
+    for (map<pair<ADDRINT, UINT32>, LAYOUT_SITE*>::iterator it = g_sites.begin(); it != g_sites.end(); ++it) {
+        const LAYOUT_SITE* s = it->second;
+        if (s->numRuns == 0) continue;
+        fprintf(fp, "site: %lx sz: %u stores: %llu predicted: %.1f%% runs:", s->offset, s->size,
+            (unsigned long long)s->stores, s->stores > 1 ? 100.0 * s->correct / (s->stores - 1) : 0.0);
+        for (UINT32 r = 0; r < s->numRuns; r++) {
+            fprintf(fp, " [%p, %p] %ld x %llu", (VOID*)s->runs[r].first, (VOID*)s->runs[r].last,
+                (long)s->runs[r].stride, (unsigned long long)s->runs[r].stores);
+        }
+        if (s->runsDropped) fprintf(fp, " (%llu runs dropped)", (unsigned long long)s->runsDropped);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+    if (!Replay_Init() || !Stack_Init())
+    {
+        return Usage();
+    }
+
+    g_fpOut = fopen(KnobOutput.Value().c_str(), "wt");
+    PIN_InitLock(&g_allocLock);
+    g_minRun = KnobMinRun.Value();
+    g_maxStride = KnobMaxStride.Value();
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -9,6 +9,15 @@
 
 #include "pin.H"
 #include <iostream>
+#include "cs6501_binlog.h"
+#include "cs6501_hitcount.h"
+#include "cs6501_disasm.h"
+#include "cs6501_stack.h"
+#include "cs6501_sample.h"
+#include "cs6501_report.h"
+#include "cs6501_replay.h"
+#include "cs6501_fastforward.h"
+#include "cs6501_jitstats.h"
 using std::cerr;
 using std::endl;
 
@@ -16,7 +25,6 @@ using namespace std;
 
 ADDRINT g_addrLow, g_addrHigh;
 BOOL g_bMainExecLoaded = FALSE;
-unsigned short g_accessMap[0xFFFF];
 
 FILE* g_fpLog = 0;
 void log_init()
@@ -41,6 +49,7 @@ VOID ImageLoad(IMG img, VOID *v)
     if( IMG_IsMainExecutable(img) ) {
         g_addrLow = IMG_LowAddress(img); 
         g_addrHigh = IMG_HighAddress(img);
+        HitCount_SetImage(g_addrLow, g_addrHigh);
         
         // Use the above addresses to prune out non-interesting instructions.
         g_bMainExecLoaded = TRUE;
@@ -83,14 +92,6 @@ INT32 Usage()
 
 VOID docount() { ins_count++; }
 
-int IsStackMem_Heuristic(ADDRINT rsp, ADDRINT mem)
-{
-    if( (rsp - 0x10000) < mem && mem < (rsp + 0x10000) ) {
-        return 1;
-    }
-    return 0;
-}
-
 void LogData(VOID* addr, UINT32 size)
 {
     switch( size ) {
@@ -132,56 +133,87 @@ VOID EveryInst(ADDRINT ip,
 }
 
 // ***** Call-Back Function ***** //
-VOID RecordMemWriteAfter(VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+VOID RecordMemWriteAfter(THREADID tid, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
 {
     //ADDRINT* ipData = (ADDRINT*)ip;
     ADDRINT offset = (ADDRINT)ip - g_addrLow;
 
-    if (IsStackMem_Heuristic(*regRSP, (ADDRINT)addr)) return;   // If goes to stack memory, skip
+    // Stack writes are filtered out by the Stack_InsertIfCall / Sample_InsertIfCall
+    // If-call, except in the -stack_keep frames
+
+    UINT64 hitcount = HitCount_Inc(tid, offset);
 
-    g_accessMap[offset]++;
+    if (BinLog_Enabled()) {
+        BinLog_MemWrite(tid, offset, addr, size, *regRSP, hitcount);
+        return;
+    }
 
     //log("[MEMWRITE(AFTER)] %p (stack: %p) -> ", offset, *regRSP);
-    log("[MEMWRITE(AFTER)] %p (hitcount: %d), mem: %p (sz: %d) (stack: %p) -> ", offset, g_accessMap[offset], addr, size, *regRSP);
+    log("[MEMWRITE(AFTER)] %p (hitcount: %llu), mem: %p (sz: %d) (stack: %p) -> ", offset, hitcount, addr, size, *regRSP);
 
     LogData(addr, size);
 }
 
+// Then-call of the sampled hit map: each call stands for about -sample N stores.
+VOID RecordMemWriteAfter_Sampled(THREADID tid, SAMPLE_THREAD* st, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+{
+    Sample_Rearm(st);
+    RecordMemWriteAfter(tid, ip, addr, size, regRSP);
+}
+
 VOID Instruction(INS ins, VOID* v) { 
 
-    string strInst = INS_Disassemble(ins);  // instructions
     ADDRINT addr = INS_Address(ins);
 
     // Only print main execution instructions (skip lib's)
     if (g_bMainExecLoaded) {
         if (g_addrLow <= addr && addr < g_addrHigh) {
             ADDRINT offset = addr - g_addrLow;
-            fprintf( DBG_LOG, "[Read/Parse/Translate] [%lx] %s\n", offset, strInst.c_str());
 
-            const char* pszInst = strInst.c_str();
-            if (strstr(pszInst, "push r") == pszInst) {
+            if (IsPushInst(ins)) {
+                Disasm_LogTranslate(DBG_LOG, ins, offset, FALSE);
                 return;
             }
             
-            if (INS_IsValidForIpointAfter(ins) == TRUE && INS_IsCall(ins) == FALSE && INS_IsMemoryWrite(ins) == TRUE) {
+            BOOL instrumented = FALSE;
+            if (FF_Active() && INS_IsValidForIpointAfter(ins) == TRUE && INS_IsCall(ins) == FALSE && INS_IsMemoryWrite(ins) == TRUE) {
                 UINT32 memOperands = INS_MemoryOperandCount(ins);
                 // Iterate over each memory operand of the instruction
                 for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
                     if (INS_OperandIsImplicit(ins, memOp)) {
                         continue;
                     }
-                    if (INS_MemoryOperandIsWritten(ins, memOp))
+                    if (INS_MemoryOperandIsWritten(ins, memOp) && Sample_Enabled())
+                    {
+                        Sample_InsertIfCall(ins, IPOINT_AFTER, memOp);
+                        INS_InsertThenCall(
+                            ins, IPOINT_AFTER, (AFUNPTR)RecordMemWriteAfter_Sampled,
+                            IARG_THREAD_ID,
+                            IARG_REG_VALUE, Sample_Reg(),
+                            IARG_INST_PTR,
+                            IARG_MEMORYOP_EA, memOp,
+                            IARG_MEMORYWRITE_SIZE,
+                            IARG_REG_REFERENCE, REG_RSP,
+                            IARG_END);
+                        instrumented = TRUE;
+                    }
+                    else if (INS_MemoryOperandIsWritten(ins, memOp))
                     {
-                        INS_InsertCall(
+                        Stack_InsertIfCall(ins, IPOINT_AFTER, memOp);
+                        INS_InsertThenCall(
                             ins, IPOINT_AFTER, (AFUNPTR)RecordMemWriteAfter,
+                            IARG_THREAD_ID,
                             IARG_INST_PTR,
                             IARG_MEMORYOP_EA, memOp,
                             IARG_MEMORYWRITE_SIZE,
                             IARG_REG_REFERENCE, REG_RSP,
                             IARG_END);
+                        instrumented = TRUE;
                     }
                 }
             }
+            if (instrumented) Report_Symbolize(ins, offset);
+            Disasm_LogTranslate(DBG_LOG, ins, offset, instrumented);
         }
     }
 }
@@ -191,11 +223,15 @@ VOID Instruction(INS ins, VOID* v) {
 VOID Fini(INT32 code, VOID* v) 
 {
     // Will execute at final stage
-    for (int i=0; i<0xFFFF; i++) {
-        if (g_accessMap[i]) {
-            log("offset: %x, max-hitcount: %d\n", i, g_accessMap[i]);
-        }
+    const UINT64* hitcount = HitCount_Merge();
+    if (Sample_Enabled()) {
+        Sample_Report(DBG_LOG, hitcount, HitCount_Size());
+    }
+    else {
+        Report_TopN(DBG_LOG, hitcount, HitCount_Size(), "max-hitcount");
     }
+    FF_Report();
+    JitStats_Report(DBG_LOG);
 }
 
 /* ===================================================================== */
@@ -208,10 +244,22 @@ int main(int argc, char* argv[])
     {
         return Usage();
     }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+    JitStats_Init();
 
+    PIN_InitSymbols();
     DBG_LOG = fopen("log.txt", "wt");
+    BinLog_Init();
+    HitCount_Init();
+    if (!Stack_Init() || !Sample_Init() || !FF_Init(DBG_LOG))
+    {
+        return Usage();
+    }
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    JitStats_AddInsFunction(Instruction, "Instruction");
     PIN_AddFiniFunction(Fini, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
 
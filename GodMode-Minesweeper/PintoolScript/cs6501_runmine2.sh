@@ -1 +1,2 @@
+./cs6501_binlog_decode trace.bin >> log.txt
 grep -n 1616 log.txt > cs6501_mine.txt
\ No newline at end of file
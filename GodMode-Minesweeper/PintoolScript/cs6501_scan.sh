@@ -0,0 +1,3 @@
+# ./cs6501_scan.sh eq 0 | became 1 | changed | unchanged | list [n] | new
+echo "$*" > scanner.cmd
+cat scanner.out
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Interactive value scanner ("cheat engine") for the main image's stores.
+ *
+ *  Every non-stack store of the main executable updates an in-memory index
+ *  (address -> last value, last writer offset, write count). While the game runs,
+ *  narrowing queries are sent through the named pipe scanner.cmd and answered
+ *  through scanner.out, e.g. with cs6501_scan.sh:
+ *
+ *      ./cs6501_scan.sh eq 0        first scan: every address holding 0
+ *      ./cs6501_scan.sh became 1    ... of those, the ones whose value became 1
+ *      ./cs6501_scan.sh list        show what is left
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "cs6501_disasm.h"
+#include "cs6501_stack.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+ADDRINT g_addrLow, g_addrHigh;
+BOOL g_bMainExecLoaded = FALSE;
+FILE* g_fpLog = 0;
+
+#define DBG_LOG g_fpLog
+
+// What we know about one written address.
+struct SCAN_ENTRY {
+    UINT64 value;       // last value stored (first 8 bytes, sign-extended)
+    UINT64 snapshot;    // value at the previous query
+    ADDRINT offset;     // last writer, image offset
+    UINT64 count;       // number of stores
+    UINT32 size;        // size of the last store
+    BOOL candidate;     // still in the current scan
+};
+
+unordered_map<ADDRINT, SCAN_ENTRY> g_scanIndex;
+PIN_LOCK g_scanLock;            // guards g_scanIndex between app threads and the control thread
+BOOL g_scanActive = FALSE;      // FALSE: the next filter starts a new scan over every address
+
+PIN_THREAD_UID g_ctrlUid;
+volatile BOOL g_ctrlStop = FALSE;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobCmdPipe(KNOB_MODE_WRITEONCE, "pintool", "cmd", "scanner.cmd",
+    "named pipe the queries are read from");
+KNOB<string> KnobOutPipe(KNOB_MODE_WRITEONCE, "pintool", "out", "scanner.out",
+    "named pipe the answers are written to");
+KNOB<UINT32> KnobListMax(KNOB_MODE_WRITEONCE, "pintool", "list_max", "50",
+    "default number of candidates printed by 'list'");
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if( IMG_IsMainExecutable(img) ) {
+        g_addrLow = IMG_LowAddress(img); 
+        g_addrHigh = IMG_HighAddress(img);
+        
+        // Use the above addresses to prune out non-interesting instructions.
+        g_bMainExecLoaded = TRUE;
+        // main execution program, which we will be interested
+        fprintf(DBG_LOG, "[IMG] Main Exec.: %lx ~ %lx\n", IMG_LowAddress(img), IMG_HighAddress(img));   
+    }
+}
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool answers value-scan queries about the main image's stores through a named pipe.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+VOID RecordMemWrite(THREADID tid, ADDRINT offset, VOID* addr, UINT32 size)
+{
+    UINT64 value = 0;
+    memcpy(&value, addr, size < sizeof(value) ? size : sizeof(value));
+    // Sign-extend 1/2/4-byte stores so a counter at -1 matches "eq -1" / "lt 0"
+    if (size < sizeof(value)) {
+        UINT32 shift = 64 - 8 * size;
+        value = (UINT64)((INT64)(value << shift) >> shift);
+    }
+
+    PIN_GetLock(&g_scanLock, tid + 1);
+    SCAN_ENTRY& e = g_scanIndex[(ADDRINT)addr];
+    if (e.count == 0) e.snapshot = value;
+    e.value = value;
+    e.offset = offset;
+    e.size = size;
+    e.count++;
+    PIN_ReleaseLock(&g_scanLock);
+}
+
+VOID Instruction(INS ins, VOID* v)
+{
+    ADDRINT addr = INS_Address(ins);
+
+    if (g_bMainExecLoaded && g_addrLow <= addr && addr < g_addrHigh) {
+        ADDRINT offset = addr - g_addrLow;
+        if (IsPushInst(ins) || INS_IsCall(ins) || !INS_IsMemoryWrite(ins) || !INS_IsValidForIpointAfter(ins)) {
+            return;
+        }
+
+        UINT32 memOperands = INS_MemoryOperandCount(ins);
+        for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+            if (!INS_MemoryOperandIsWritten(ins, memOp)) continue;
+
+            Stack_InsertIfCall(ins, IPOINT_AFTER, memOp);
+            INS_InsertThenCall(
+                ins, IPOINT_AFTER, (AFUNPTR)RecordMemWrite,
+                IARG_THREAD_ID,
+                IARG_ADDRINT, offset,
+                IARG_MEMORYOP_EA, memOp,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_END);
+        }
+        Disasm_LogTranslate(DBG_LOG, ins, offset, TRUE);
+    }
+}
+
+/* ===================================================================== */
+/* Queries */
+/* ===================================================================== */
+
+enum SCAN_FILTER { FILTER_EQ, FILTER_NE, FILTER_GT, FILTER_LT, FILTER_BECAME, FILTER_CHANGED, FILTER_UNCHANGED };
+
+BOOL ScanKeep(const SCAN_ENTRY& e, SCAN_FILTER filter, INT64 v)
+{
+    INT64 value = (INT64)e.value;
+    switch (filter) {
+    case FILTER_EQ:         return value == v;
+    case FILTER_NE:         return value != v;
+    case FILTER_GT:         return value > v;
+    case FILTER_LT:         return value < v;
+    case FILTER_BECAME:     return value == v && (INT64)e.snapshot != v;
+    case FILTER_CHANGED:    return e.value != e.snapshot;
+    case FILTER_UNCHANGED:  return e.value == e.snapshot;
+    }
+    return FALSE;
+}
+
+// Narrows the current scan (or starts one) and snapshots every value.
+UINT64 ScanFilter(SCAN_FILTER filter, INT64 v)
+{
+    UINT64 left = 0;
+    for (unordered_map<ADDRINT, SCAN_ENTRY>::iterator it = g_scanIndex.begin(); it != g_scanIndex.end(); ++it) {
+        SCAN_ENTRY& e = it->second;
+        e.candidate = (e.candidate || !g_scanActive) && ScanKeep(e, filter, v);
+        e.snapshot = e.value;
+        if (e.candidate) left++;
+    }
+    g_scanActive = TRUE;
+    return left;
+}
+
+bool CompareAddr(const pair<ADDRINT, SCAN_ENTRY>& a, const pair<ADDRINT, SCAN_ENTRY>& b) { return a.first < b.first; }
+
+VOID ScanList(FILE* fp, UINT32 max)
+{
+    vector<pair<ADDRINT, SCAN_ENTRY> > hits;
+    for (unordered_map<ADDRINT, SCAN_ENTRY>::iterator it = g_scanIndex.begin(); it != g_scanIndex.end(); ++it) {
+        if (!g_scanActive || it->second.candidate) hits.push_back(*it);
+    }
+    sort(hits.begin(), hits.end(), CompareAddr);
+
+    fprintf(fp, "%lu addresses\n", (unsigned long)hits.size());
+    for (size_t i = 0; i < hits.size() && i < max; i++) {
+        const SCAN_ENTRY& e = hits[i].second;
+        fprintf(fp, "mem: %p (sz: %d) value: %lld writer: %lx count: %llu\n", (VOID*)hits[i].first, e.size,
+            (long long)e.value, e.offset, (unsigned long long)e.count);
+    }
+}
+
+VOID ScanCommand(FILE* fp, char* line)
+{
+    static const struct { const char* name; SCAN_FILTER filter; BOOL hasValue; } filters[] = {
+        { "eq", FILTER_EQ, TRUE }, { "ne", FILTER_NE, TRUE }, { "gt", FILTER_GT, TRUE }, { "lt", FILTER_LT, TRUE },
+        { "became", FILTER_BECAME, TRUE }, { "changed", FILTER_CHANGED, FALSE }, { "unchanged", FILTER_UNCHANGED, FALSE },
+    };
+    char* cmd = strtok(line, " \t\r\n");
+    char* arg = strtok(0, " \t\r\n");
+    if (cmd == 0) return;
+
+    fprintf(DBG_LOG, "[SCAN] %s %s\n", cmd, arg ? arg : "");
+    for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        if (strcmp(cmd, filters[i].name) != 0) continue;
+        if (filters[i].hasValue && arg == 0) {
+            fprintf(fp, "usage: %s <value>\n", cmd);
+            return;
+        }
+        fprintf(fp, "%llu candidates\n", (unsigned long long)ScanFilter(filters[i].filter, arg ? strtoll(arg, 0, 0) : 0));
+        return;
+    }
+    if (strcmp(cmd, "list") == 0) {
+        ScanList(fp, arg ? strtoul(arg, 0, 0) : KnobListMax.Value());
+    }
+    else if (strcmp(cmd, "new") == 0) {
+        g_scanActive = FALSE;
+        fprintf(fp, "%lu addresses indexed\n", (unsigned long)g_scanIndex.size());
+    }
+    else {
+        fprintf(fp, "commands: eq|ne|gt|lt|became <value>, changed, unchanged, list [n], new\n");
+    }
+}
+
+/* ===================================================================== */
+/* Control Thread */
+/* ===================================================================== */
+
+// The answer pipe is opened per query; give the client a moment to open its end.
+FILE* OpenAnswerPipe()
+{
+    for (int i = 0; i < 200 && !g_ctrlStop; i++) {
+        int fd = open(KnobOutPipe.Value().c_str(), O_WRONLY | O_NONBLOCK);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fdopen(fd, "w");
+        }
+        PIN_Sleep(10);
+    }
+    return 0;
+}
+
+VOID ControlThread(VOID* v)
+{
+    THREADID tid = PIN_ThreadId();
+    int fd = open(KnobCmdPipe.Value().c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(DBG_LOG, "[SCAN] cannot open %s\n", KnobCmdPipe.Value().c_str());
+        return;
+    }
+
+    string pending;
+    char buf[256];
+    while (!g_ctrlStop && !PIN_IsProcessExiting()) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            PIN_Sleep(20);  // no writer or nothing to read yet
+            continue;
+        }
+        pending.append(buf, n);
+
+        size_t eol;
+        while ((eol = pending.find('\n')) != string::npos) {
+            string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+
+            FILE* fp = OpenAnswerPipe();
+            PIN_GetLock(&g_scanLock, tid + 1);
+            ScanCommand(fp ? fp : DBG_LOG, &line[0]);
+            PIN_ReleaseLock(&g_scanLock);
+            if (fp) fclose(fp);
+            fflush(DBG_LOG);
+        }
+    }
+    close(fd);
+}
+
+VOID PrepareForFini(VOID* v)
+{
+    g_ctrlStop = TRUE;
+    PIN_WaitForThreadTermination(g_ctrlUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+/* ===================================================================== */
+
+VOID Fini(INT32 code, VOID* v)
+{
+    // Leave the final state in log.txt
+    char line[] = "list 1000000";
+    ScanCommand(DBG_LOG, line);
+    unlink(KnobCmdPipe.Value().c_str());
+    unlink(KnobOutPipe.Value().c_str());
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    if (PIN_Init(argc, argv) || !Stack_Init())
+    {
+        return Usage();
+    }
+
+    DBG_LOG = fopen("log.txt", "wt");
+    PIN_InitLock(&g_scanLock);
+
+    // Stale files from an earlier run may not be pipes
+    unlink(KnobCmdPipe.Value().c_str());
+    unlink(KnobOutPipe.Value().c_str());
+    if (mkfifo(KnobCmdPipe.Value().c_str(), 0600) != 0 || mkfifo(KnobOutPipe.Value().c_str(), 0600) != 0) {
+        cerr << "cannot create the named pipes " << KnobCmdPipe.Value() << " / " << KnobOutPipe.Value() << endl;
+        return -1;
+    }
+
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    PIN_AddFiniFunction(Fini, 0);
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    PIN_SpawnInternalThread(ControlThread, 0, 0, &g_ctrlUid);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -9,6 +9,12 @@
 
 #include "pin.H"
 #include <iostream>
+#include "cs6501_disasm.h"
+#include <algorithm>
+#include "cs6501_replay.h"
+#include "cs6501_fastforward.h"
+#include "cs6501_imagemap.h"
+#include "cs6501_jitstats.h"
 using std::cerr;
 using std::endl;
 
@@ -20,6 +26,8 @@ FILE* g_fpLog = 0;
 
 #define DBG_LOG g_fpLog
 
+VOID CollisionInstrument(IMG img);
+
 VOID ImageLoad(IMG img, VOID *v)
 {
     if( IMG_IsMainExecutable(img) ) {
@@ -28,6 +36,7 @@ VOID ImageLoad(IMG img, VOID *v)
         
         // Use the above addresses to prune out non-interesting instructions.
         g_bMainExecLoaded = TRUE;
+        CollisionInstrument(img);
         // main execution program, which we will be interested
         fprintf(DBG_LOG, "[IMG] Main Exec.: %lx ~ %lx\n", IMG_LowAddress(img), IMG_HighAddress(img));   
     }
@@ -43,10 +52,66 @@ VOID ImageLoad(IMG img, VOID *v)
 
 UINT64 ins_count = 0;
 
+// Instruction count of one routine; BBLs outside any routine share one record per image.
+struct RTN_COUNT {
+    string name;
+    string image;
+    ADDRINT address;
+    UINT32 index;       // of its counter in every COUNT_THREAD
+    UINT64 icount;      // summed over the threads at Fini
+};
+
+#define COUNT_CHUNK 4096        // routine counters per chunk
+#define COUNT_CHUNKS 1024       // chunks per thread
+
+// Per-thread routine counters, reached through g_countReg so docount stays an
+// unlocked inlined add. Every thread gets every chunk as soon as it is created.
+struct COUNT_THREAD {
+    UINT64* chunks[COUNT_CHUNKS];
+};
+
+map<ADDRINT, RTN_COUNT*> g_rtnCounts;   // by routine address
+map<UINT32, RTN_COUNT*> g_noRtnCounts;  // by image id (0: no image)
+vector<RTN_COUNT*> g_countRtns;         // by index
+REG g_countReg = REG_INVALID();
+PIN_LOCK g_countLock;                   // guards g_countThreads and g_countChunks
+vector<COUNT_THREAD*> g_countThreads;
+UINT32 g_countChunks = 0;               // chunks allocated in every thread
+
+// One controlCollision() call, buffered per thread and written to the log in bulk.
+struct COLLISION_CALL {
+    INT32 args[5];      // pipeCol, birdCol, birdRow, crackStart, crackFinish
+    INT32 ret;          // what the game computed
+};
+
+#define COLLISION_BUF_SIZE 4096
+
+struct COLLISION_BUF {
+    COLLISION_CALL calls[COLLISION_BUF_SIZE];
+    UINT32 n;
+    INT32 args[5];      // of the call in progress
+};
+
+TLS_KEY g_collisionKey = INVALID_TLS_KEY;
+PIN_LOCK g_collisionLock;               // guards g_collisionBufs, the log and g_collisionRets
+vector<COLLISION_BUF*> g_collisionBufs;  // flushed at Fini
+map<INT32, UINT64> g_collisionRets;     // return value -> calls
+
 /* ===================================================================== */
 /* Commandline Switches */
 /* ===================================================================== */
 
+KNOB<BOOL> KnobCount(KNOB_MODE_WRITEONCE, "pintool", "count", "1",
+    "count instructions per basic block");
+KNOB<string> KnobCountFile(KNOB_MODE_WRITEONCE, "pintool", "count_file", "icount.out",
+    "per-image / per-routine instruction count report");
+KNOB<string> KnobCollisionRtn(KNOB_MODE_WRITEONCE, "pintool", "collision_rtn", "_Z16controlCollisioniiiii",
+    "routine whose return value is rewritten (empty: none)");
+KNOB<INT32> KnobCollisionRet(KNOB_MODE_WRITEONCE, "pintool", "collision_ret", "0",
+    "value -collision_rtn returns (0: never collide, -1: keep the real value)");
+KNOB<BOOL> KnobCollisionLog(KNOB_MODE_WRITEONCE, "pintool", "collision_log", "1",
+    "log the arguments and return value of every -collision_rtn call");
+
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -65,21 +130,223 @@ INT32 Usage()
 
 /* ===================================================================== */
 
-VOID docount() { ins_count++; }
+// One inlined add per executed BBL, into the executing thread's own counter.
+VOID PIN_FAST_ANALYSIS_CALL docount(COUNT_THREAD* ct, UINT32 index, UINT32 numIns)
+{
+    ct->chunks[index / COUNT_CHUNK][index % COUNT_CHUNK] += numIns;
+}
+
+VOID CountThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    COUNT_THREAD* ct = new COUNT_THREAD();
+    PIN_GetLock(&g_countLock, tid + 1);
+    for (UINT32 c = 0; c < g_countChunks; c++) ct->chunks[c] = new UINT64[COUNT_CHUNK]();
+    g_countThreads.push_back(ct);
+    PIN_ReleaseLock(&g_countLock);
+    PIN_SetContextReg(ctxt, g_countReg, (ADDRINT)ct);
+}
+
+// 0 once COUNT_CHUNKS * COUNT_CHUNK routines have a counter.
+RTN_COUNT* NewRtnCount(const string& name, ADDRINT address, IMG img)
+{
+    UINT32 index = g_countRtns.size();
+    if (index == COUNT_CHUNKS * COUNT_CHUNK) return 0;
+    if (index % COUNT_CHUNK == 0) {
+        PIN_GetLock(&g_countLock, PIN_ThreadId() + 1);
+        for (size_t i = 0; i < g_countThreads.size(); i++) {
+            g_countThreads[i]->chunks[g_countChunks] = new UINT64[COUNT_CHUNK]();
+        }
+        g_countChunks++;
+        PIN_ReleaseLock(&g_countLock);
+    }
+
+    RTN_COUNT* rc = new RTN_COUNT;
+    rc->name = name;
+    rc->image = IMG_Valid(img) ? IMG_Name(img) : "[unknown]";
+    rc->address = address;
+    rc->index = index;
+    rc->icount = 0;
+    g_countRtns.push_back(rc);
+    return rc;
+}
+
+RTN_COUNT* LookupRtnCount(ADDRINT addr)
+{
+    RTN rtn = RTN_FindByAddress(addr);
+    IMG img = IMG_FindByAddress(addr);
+
+    if (RTN_Valid(rtn)) {
+        RTN_COUNT*& rc = g_rtnCounts[RTN_Address(rtn)];
+        if (rc == 0) rc = NewRtnCount(RTN_Name(rtn), RTN_Address(rtn), img);
+        return rc;
+    }
+    UINT32 id = IMG_Valid(img) ? IMG_Id(img) : 0;
+    RTN_COUNT*& rc = g_noRtnCounts[id];
+    if (rc == 0) rc = NewRtnCount("[unknown]", IMG_Valid(img) ? IMG_LowAddress(img) : 0, img);
+    return rc;
+}
+
+VOID Trace(TRACE trace, VOID* v)
+{
+    if (!FF_Active()) return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        ADDRINT addr = BBL_Address(bbl);
+        if (!ImageMap_Instrumented(addr)) {
+            continue;   // main executable and -libs images only
+        }
+
+        RTN_COUNT* rc = LookupRtnCount(addr);
+        if (rc == 0) continue;
+        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)docount, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_countReg,
+            IARG_UINT32, rc->index,
+            IARG_UINT32, BBL_NumIns(bbl),
+            IARG_END);
+    }
+}
+
+bool CompareRtnCount(const RTN_COUNT* a, const RTN_COUNT* b) { return a->icount > b->icount; }
+
+VOID WriteCountReport()
+{
+    vector<RTN_COUNT*> rtns;
+    map<string, UINT64> imgCounts;
+    map<ADDRINT, RTN_COUNT*>::iterator it;
+    map<UINT32, RTN_COUNT*>::iterator it2;
+
+    for (size_t i = 0; i < g_countRtns.size(); i++) {
+        RTN_COUNT* rc = g_countRtns[i];
+        for (size_t t = 0; t < g_countThreads.size(); t++) {
+            rc->icount += g_countThreads[t]->chunks[rc->index / COUNT_CHUNK][rc->index % COUNT_CHUNK];
+        }
+    }
+    for (it = g_rtnCounts.begin(); it != g_rtnCounts.end(); ++it) if (it->second) rtns.push_back(it->second);
+    for (it2 = g_noRtnCounts.begin(); it2 != g_noRtnCounts.end(); ++it2) if (it2->second) rtns.push_back(it2->second);
+    for (size_t i = 0; i < rtns.size(); i++) {
+        ins_count += rtns[i]->icount;
+        imgCounts[rtns[i]->image] += rtns[i]->icount;
+    }
+    sort(rtns.begin(), rtns.end(), CompareRtnCount);
+
+    FILE* fp = fopen(KnobCountFile.Value().c_str(), "wt");
+    if (fp == 0) return;
+
+    fprintf(fp, "# total: %llu\n", (unsigned long long)ins_count);
+    fprintf(fp, "# image, icount\n");
+    for (map<string, UINT64>::iterator im = imgCounts.begin(); im != imgCounts.end(); ++im) {
+        fprintf(fp, "%s, %llu\n", im->first.c_str(), (unsigned long long)im->second);
+    }
+    fprintf(fp, "# routine, address, image, icount\n");
+    for (size_t i = 0; i < rtns.size() && rtns[i]->icount; i++) {
+        fprintf(fp, "%s, %lx, %s, %llu\n", rtns[i]->name.c_str(), rtns[i]->address,
+            rtns[i]->image.c_str(), (unsigned long long)rtns[i]->icount);
+    }
+    fclose(fp);
+}
 
 /* ===================================================================== */
 
-VOID EveryInst(ADDRINT ip, 
-               ADDRINT * regRAX, 
-               ADDRINT * regRBX,
-               ADDRINT * regRCX, 
-               ADDRINT * regRDX) 
+/* ===================================================================== */
+/* controlCollision hook */
+/* ===================================================================== */
+
+COLLISION_BUF* CollisionBuf(THREADID tid)
 {
-    // ip: IARG_INST_PTR
-    fprintf(DBG_LOG, "[Real Execution] EAX: %lx\n", *regRAX); // read value
-    *regRAX = 0; // new value
+    COLLISION_BUF* buf = static_cast<COLLISION_BUF*>(PIN_GetThreadData(g_collisionKey, tid));
+    if (buf == 0) {
+        buf = new COLLISION_BUF();
+        PIN_SetThreadData(g_collisionKey, buf, tid);
+        PIN_GetLock(&g_collisionLock, tid + 1);
+        g_collisionBufs.push_back(buf);
+        PIN_ReleaseLock(&g_collisionLock);
+    }
+    return buf;
+}
+
+VOID CollisionFlush(THREADID tid, COLLISION_BUF* buf)
+{
+    PIN_GetLock(&g_collisionLock, tid + 1);
+    for (UINT32 i = 0; i < buf->n; i++) {
+        const COLLISION_CALL& c = buf->calls[i];
+        g_collisionRets[c.ret]++;
+        if (KnobCollisionLog.Value()) {
+            fprintf(DBG_LOG, "[COLLISION] pipeCol %d, birdCol %d, birdRow %d, crack %d-%d -> %d\n",
+                c.args[0], c.args[1], c.args[2], c.args[3], c.args[4], c.ret);
+        }
+    }
+    PIN_ReleaseLock(&g_collisionLock);
+    buf->n = 0;
+}
+
+VOID CollisionEnter(THREADID tid, ADDRINT a0, ADDRINT a1, ADDRINT a2, ADDRINT a3, ADDRINT a4)
+{
+    INT32* args = CollisionBuf(tid)->args;
+    args[0] = (INT32)a0;
+    args[1] = (INT32)a1;
+    args[2] = (INT32)a2;
+    args[3] = (INT32)a3;
+    args[4] = (INT32)a4;
+}
+
+// Once per call, at the routine's exit: record, then rewrite the returned EAX.
+VOID CollisionExit(THREADID tid, ADDRINT* ret)
+{
+    COLLISION_BUF* buf = CollisionBuf(tid);
+    COLLISION_CALL& c = buf->calls[buf->n];
+    memcpy(c.args, buf->args, sizeof(c.args));
+    c.ret = (INT32)*ret;
+    if (++buf->n == COLLISION_BUF_SIZE) CollisionFlush(tid, buf);
+
+    if (KnobCollisionRet.Value() != -1) *ret = (UINT32)KnobCollisionRet.Value();
+}
+
+// Found by name, so a rebuilt flappybird (other call-site offsets) needs no change.
+VOID CollisionInstrument(IMG img)
+{
+    if (KnobCollisionRtn.Value().empty()) return;
+
+    RTN rtn = RTN_FindByName(img, KnobCollisionRtn.Value().c_str());
+    if (!RTN_Valid(rtn)) {
+        fprintf(DBG_LOG, "[COLLISION] %s not found in the main image\n", KnobCollisionRtn.Value().c_str());
+        return;
+    }
+    RTN_Open(rtn);
+    if (KnobCollisionLog.Value()) {
+        RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)CollisionEnter,
+            IARG_THREAD_ID,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 3,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 4,
+            IARG_END);
+    }
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)CollisionExit,
+        IARG_THREAD_ID,
+        IARG_FUNCRET_EXITPOINT_REFERENCE,
+        IARG_END);
+    RTN_Close(rtn);
+    fprintf(DBG_LOG, "[COLLISION] %s hooked at offset %lx\n", KnobCollisionRtn.Value().c_str(), RTN_Address(rtn) - g_addrLow);
 }
 
+VOID CollisionReport()
+{
+    if (KnobCollisionRtn.Value().empty()) return;
+    for (size_t i = 0; i < g_collisionBufs.size(); i++) CollisionFlush(PIN_ThreadId(), g_collisionBufs[i]);
+
+    UINT64 calls = 0;
+    for (map<INT32, UINT64>::iterator it = g_collisionRets.begin(); it != g_collisionRets.end(); ++it) calls += it->second;
+    fprintf(DBG_LOG, "[COLLISION] %llu calls", (unsigned long long)calls);
+    for (map<INT32, UINT64>::iterator it = g_collisionRets.begin(); it != g_collisionRets.end(); ++it) {
+        fprintf(DBG_LOG, ", returned %d: %llu", it->first, (unsigned long long)it->second);
+    }
+    if (KnobCollisionRet.Value() != -1) fprintf(DBG_LOG, " (all rewritten to %d)", KnobCollisionRet.Value());
+    fprintf(DBG_LOG, "\n");
+}
+
+/* ===================================================================== */
+
 VOID RecordMemWriteBefore(VOID * ip, VOID * addr, UINT32 size)
 {
     fprintf(DBG_LOG, "[Real Execution] [MEMWRITE(BEFORE)] %p, memaddr: %p, size: %d\n", ip, addr, size);
@@ -116,33 +383,18 @@ VOID RecordMemRead(VOID * ip, VOID * addr, UINT32 size)
 
 VOID Instruction(INS ins, VOID* v) { 
 
-    string strInst = INS_Disassemble(ins);  // instructions
     ADDRINT addr = INS_Address(ins);
 
     // Only print main execution instructions (skip lib's)
     if (g_bMainExecLoaded) {
         if (g_addrLow <= addr && addr < g_addrHigh) {
-            fprintf( DBG_LOG, "[Read/Parse/Translate] [%lx] %s\n", addr - g_addrLow, strInst.c_str()); // addr - g_addrLow: relative position
-            
-            ADDRINT offset = addr - g_addrLow; 
+            ADDRINT offset = addr - g_addrLow; // relative position
+            BOOL instrumented = TRUE;
 
+            // controlCollision()'s result (0x1c5d / 0x1d03) is rewritten by CollisionExit
             switch (offset) {
-            case 0x1c5d:
-            case 0x1d03: 
-                // we want to change the particular value of the function controlCollision()
-                // A function always returns its value to EAX register.
-
-                //INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
-                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)EveryInst, IARG_INST_PTR, 
-                    IARG_REG_REFERENCE, REG_RAX, 
-                    IARG_REG_REFERENCE, REG_RBX, 
-                    IARG_REG_REFERENCE, REG_RCX, 
-                    IARG_REG_REFERENCE, REG_RDX, 
-                    IARG_END); 
-                break;
-
             case 0x1d92:
-                {
+                if (FF_Active()) {
                     UINT32 memOperands = INS_MemoryOperandCount(ins);
                     // Iterate over each memory operand of the instruction.
                     for (UINT32 memOp = 0; memOp < memOperands; memOp++)
@@ -180,15 +432,24 @@ VOID Instruction(INS ins, VOID* v) {
                 break;
             
             default:
+                instrumented = FALSE;
                 break;
             }
+            Disasm_LogTranslate(DBG_LOG, ins, offset, instrumented);
         }
     }
 }
 
 /* ===================================================================== */
 
-VOID Fini(INT32 code, VOID* v) { cerr << "Count " << ins_count << endl; }
+VOID Fini(INT32 code, VOID* v)
+{
+    if (KnobCount.Value()) WriteCountReport();
+    cerr << "Count " << ins_count << endl;
+    CollisionReport();
+    FF_Report();
+    JitStats_Report(DBG_LOG);
+}
 
 /* ===================================================================== */
 /* Main                                                                  */
@@ -196,14 +457,37 @@ VOID Fini(INT32 code, VOID* v) { cerr << "Count " << ins_count << endl; }
 
 int main(int argc, char* argv[])
 {
+    PIN_InitSymbols();
     if (PIN_Init(argc, argv))
     {
         return Usage();
     }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+    JitStats_Init();
 
     DBG_LOG = fopen("log.txt", "wt");
+    if (!FF_Init(DBG_LOG))
+    {
+        return Usage();
+    }
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    ImageMap_Init();
+    PIN_InitLock(&g_collisionLock);
+    g_collisionKey = PIN_CreateThreadDataKey(0);
+    JitStats_AddInsFunction(Instruction, "Instruction");
+    if (KnobCount.Value()) {
+        g_countReg = PIN_ClaimToolRegister();
+        if (!REG_valid(g_countReg)) {
+            fprintf(stderr, "[COUNT] no tool register available\n");
+            return Usage();
+        }
+        PIN_InitLock(&g_countLock);
+        PIN_AddThreadStartFunction(CountThreadStart, 0);
+        JitStats_AddTraceFunction(Trace, "Trace");
+    }
     PIN_AddFiniFunction(Fini, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
 
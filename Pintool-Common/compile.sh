@@ -0,0 +1,4 @@
+g++ -O2 -o cs6501_binlog_decode cs6501_binlog_decode.cpp
+g++ -O2 -o cs6501_elfpatch cs6501_elfpatch.cpp
+g++ -O2 -o cs6501_dirtydiff cs6501_dirtydiff.cpp
+g++ -O2 -o cs6501_tracediff cs6501_tracediff.cpp
@@ -0,0 +1,212 @@
+/*! @file
+ *  Binary trace backend for the cs6501 Pin tools.
+ *
+ *  The analysis routines only fill a fixed-size BINLOG_RECORD in a per-thread
+ *  ring buffer; an internal Pin thread drains the rings into trace.bin.
+ *  Use cs6501_binlog_decode to turn trace.bin back into the log.txt text.
+ */
+
+#ifndef CS6501_BINLOG_H
+#define CS6501_BINLOG_H
+
+#include "pin.H"
+#include "cs6501_binlog_format.h"
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<BOOL> KnobBinLog(KNOB_MODE_WRITEONCE, "pintool", "binlog", "1",
+    "write store records to the binary trace instead of log.txt");
+KNOB<std::string> KnobBinLogFile(KNOB_MODE_WRITEONCE, "pintool", "binlog_file", "trace.bin",
+    "binary trace file name");
+KNOB<UINT32> KnobBinLogRing(KNOB_MODE_WRITEONCE, "pintool", "binlog_ring", "8192",
+    "records per thread ring buffer (rounded up to a power of two)");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define BINLOG_MAX_THREADS 256
+
+struct BINLOG_RING {
+    BINLOG_RECORD* recs;
+    UINT64 mask;
+    volatile UINT64 head;   // next slot filled by the application thread
+    volatile UINT64 tail;   // next slot drained by the writer thread
+    UINT64 seq;
+};
+
+static FILE* g_fpBinLog = 0;
+static PIN_LOCK g_binLogLock;           // guards g_fpBinLog and g_binLogRings
+static TLS_KEY g_binLogKey = INVALID_TLS_KEY;
+static BINLOG_RING* g_binLogRings[BINLOG_MAX_THREADS];
+static UINT32 g_binLogNumRings = 0;
+static UINT32 g_binLogNumLabels = 0;
+static volatile BOOL g_binLogStop = FALSE;
+static PIN_THREAD_UID g_binLogWriterUid;
+
+/* ===================================================================== */
+
+static UINT64 BinLog_DrainRing(BINLOG_RING* ring)
+{
+    UINT64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    UINT64 tail = ring->tail;
+    UINT64 n = head - tail;
+    if (n == 0) return 0;
+
+    // At most two fwrite calls: up to the end of the ring, then the wrapped part.
+    UINT64 first = tail & ring->mask;
+    UINT64 chunk = ring->mask + 1 - first;
+    if (chunk > n) chunk = n;
+    fwrite(&ring->recs[first], sizeof(BINLOG_RECORD), chunk, g_fpBinLog);
+    if (chunk < n) {
+        fwrite(&ring->recs[0], sizeof(BINLOG_RECORD), n - chunk, g_fpBinLog);
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+static UINT64 BinLog_DrainAll(THREADID tid)
+{
+    UINT64 n = 0;
+    PIN_GetLock(&g_binLogLock, tid + 1);
+    for (UINT32 i = 0; i < g_binLogNumRings; i++) {
+        n += BinLog_DrainRing(g_binLogRings[i]);
+    }
+    PIN_ReleaseLock(&g_binLogLock);
+    return n;
+}
+
+static VOID BinLog_WriterThread(VOID* v)
+{
+    THREADID tid = PIN_ThreadId();
+    while (!g_binLogStop && !PIN_IsProcessExiting()) {
+        if (BinLog_DrainAll(tid) == 0) {
+            PIN_Sleep(1);
+        }
+    }
+}
+
+static VOID BinLog_ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    UINT64 cap = 2;
+    while (cap < KnobBinLogRing.Value()) cap <<= 1;
+
+    BINLOG_RING* ring = new BINLOG_RING;
+    ring->recs = new BINLOG_RECORD[cap];
+    ring->mask = cap - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->seq = 0;
+    PIN_SetThreadData(g_binLogKey, ring, tid);
+
+    PIN_GetLock(&g_binLogLock, tid + 1);
+    if (g_binLogNumRings < BINLOG_MAX_THREADS) {
+        g_binLogRings[g_binLogNumRings++] = ring;
+    }
+    else {
+        fprintf(stderr, "[BINLOG] more than %d threads, records of thread %d dropped\n", BINLOG_MAX_THREADS, tid);
+        ring->mask = 0;  // never drained: BinLog_Write skips it
+    }
+    PIN_ReleaseLock(&g_binLogLock);
+}
+
+static VOID BinLog_PrepareForFini(VOID* v)
+{
+    // The writer must be gone before Pin starts tearing down threads.
+    g_binLogStop = TRUE;
+    PIN_WaitForThreadTermination(g_binLogWriterUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+static VOID BinLog_Fini(INT32 code, VOID* v)
+{
+    BinLog_DrainAll(PIN_ThreadId());
+    fclose(g_fpBinLog);
+    g_fpBinLog = 0;
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+inline BOOL BinLog_Enabled() { return g_fpBinLog != 0; }
+
+// Call from main() after PIN_Init. Does nothing if -binlog 0.
+VOID BinLog_Init()
+{
+    if (!KnobBinLog.Value()) return;
+
+    g_fpBinLog = fopen(KnobBinLogFile.Value().c_str(), "wb");
+    if (g_fpBinLog == 0) {
+        fprintf(stderr, "[BINLOG] cannot open %s, falling back to text log\n", KnobBinLogFile.Value().c_str());
+        return;
+    }
+    BINLOG_FILE_HEADER hdr;
+    memcpy(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic));
+    hdr.version = BINLOG_VERSION;
+    hdr.recordSize = sizeof(BINLOG_RECORD);
+    fwrite(&hdr, sizeof(hdr), 1, g_fpBinLog);
+
+    PIN_InitLock(&g_binLogLock);
+    g_binLogKey = PIN_CreateThreadDataKey(0);
+    PIN_AddThreadStartFunction(BinLog_ThreadStart, 0);
+    PIN_AddPrepareForFiniFunction(BinLog_PrepareForFini, 0);
+    PIN_AddFiniFunction(BinLog_Fini, 0);
+    PIN_SpawnInternalThread(BinLog_WriterThread, 0, 0, &g_binLogWriterUid);
+}
+
+// Registers a name for BinLog_MemWriteNamed(). Call from main() after BinLog_Init.
+UINT8 BinLog_DefineLabel(const char* name)
+{
+    UINT8 id = (UINT8)g_binLogNumLabels++;
+    if (!BinLog_Enabled()) return id;
+
+    BINLOG_RECORD rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = BINLOG_KIND_LABEL;
+    rec.label = id;
+    strncpy((char*)rec.data, name, BINLOG_LABEL_MAX - 1);
+    fwrite(&rec, sizeof(rec), 1, g_fpBinLog);
+    return id;
+}
+
+// Hot path: copies one record into the calling thread's ring. No formatting, no stdio.
+inline VOID BinLog_Write(THREADID tid, UINT8 kind, UINT8 label, ADDRINT offset,
+                         VOID* addr, UINT32 size, ADDRINT rsp, UINT64 hitcount)
+{
+    BINLOG_RING* ring = static_cast<BINLOG_RING*>(PIN_GetThreadData(g_binLogKey, tid));
+    if (ring == 0 || ring->mask == 0) return;
+
+    // Ring full: wait for the writer. Once it has stopped the file may already
+    // be closed by BinLog_Fini, so the record is dropped.
+    while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        if (g_binLogStop) return;
+        PIN_Yield();
+    }
+
+    BINLOG_RECORD* rec = &ring->recs[ring->head & ring->mask];
+    rec->offset = offset;
+    rec->addr = (ADDRINT)addr;
+    rec->rsp = rsp;
+    rec->hitcount = hitcount;
+    rec->seq = ring->seq++;
+    rec->size = (UINT16)size;
+    rec->kind = kind;
+    rec->label = label;
+    rec->tid = tid;
+    memcpy(rec->data, addr, size < BINLOG_DATA_MAX ? size : BINLOG_DATA_MAX);
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+inline VOID BinLog_MemWrite(THREADID tid, ADDRINT offset, VOID* addr, UINT32 size, ADDRINT rsp, UINT64 hitcount)
+{
+    BinLog_Write(tid, BINLOG_KIND_MEMWRITE_AFTER, 0, offset, addr, size, rsp, hitcount);
+}
+
+inline VOID BinLog_MemWriteNamed(THREADID tid, UINT8 label, ADDRINT offset, VOID* addr, UINT32 size)
+{
+    BinLog_Write(tid, BINLOG_KIND_MEMWRITE_NAMED, label, offset, addr, size, 0, 0);
+}
+
+#endif // CS6501_BINLOG_H
@@ -0,0 +1,95 @@
+/*! @file
+ *  Offline decoder for the binary trace written by cs6501_binlog.h.
+ *  Prints the records in the same text format the Pin tools write to log.txt:
+ *
+ *      ./cs6501_binlog_decode trace.bin >> log.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cs6501_binlog_format.h"
+
+static char g_labels[256][BINLOG_LABEL_MAX];
+
+// Same output as LogData() in the Pin tools.
+void LogData(const BINLOG_RECORD& rec)
+{
+    switch (rec.size) {
+    case 4:
+        {
+            unsigned int data;
+            memcpy(&data, rec.data, sizeof(data));
+            printf("%d\n", data);
+        }
+        break;
+    case 8:
+        {
+            long long data;
+            memcpy(&data, rec.data, sizeof(data));
+            printf("%lld\n", data);
+        }
+        break;
+    default:
+        {
+            unsigned int n = rec.size < BINLOG_DATA_MAX ? rec.size : BINLOG_DATA_MAX;
+            for (unsigned int i = 0; i < n; i++) {
+                printf("%02x ", rec.data[i]);
+            }
+            if (n < rec.size) {
+                printf("(+%d bytes not recorded)", rec.size - n);
+            }
+            printf("\n");
+        }
+        break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[1], "rb");
+    if (fp == 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    BINLOG_FILE_HEADER hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "%s: not a cs6501 binary trace\n", argv[1]);
+        return 1;
+    }
+    if (hdr.version != BINLOG_VERSION || hdr.recordSize != sizeof(BINLOG_RECORD)) {
+        fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n", argv[1], hdr.version, hdr.recordSize);
+        return 1;
+    }
+
+    BINLOG_RECORD rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        switch (rec.kind) {
+        case BINLOG_KIND_LABEL:
+            memcpy(g_labels[rec.label], rec.data, BINLOG_LABEL_MAX);
+            g_labels[rec.label][BINLOG_LABEL_MAX - 1] = 0;
+            break;
+        case BINLOG_KIND_MEMWRITE_AFTER:
+            printf("[MEMWRITE(AFTER)] %p (hitcount: %llu), mem: %p (sz: %d) (stack: %p) -> ",
+                (void*)rec.offset, (unsigned long long)rec.hitcount, (void*)rec.addr, rec.size, (void*)rec.rsp);
+            LogData(rec);
+            break;
+        case BINLOG_KIND_MEMWRITE_NAMED:
+            printf("[MEMWRITE] %s %p mem: %p (sz: %d) -> ",
+                g_labels[rec.label], (void*)rec.offset, (void*)rec.addr, rec.size);
+            LogData(rec);
+            break;
+        default:
+            fprintf(stderr, "%s: unknown record kind %d, skipped\n", argv[1], rec.kind);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
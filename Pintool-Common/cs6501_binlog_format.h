@@ -0,0 +1,42 @@
+/*! @file
+ *  On-disk layout of the binary trace written by cs6501_binlog.h.
+ *  Kept free of pin.H so the offline decoder can include it as well.
+ */
+
+#ifndef CS6501_BINLOG_FORMAT_H
+#define CS6501_BINLOG_FORMAT_H
+
+#include <stdint.h>
+
+#define BINLOG_MAGIC        "CS6501TR"
+#define BINLOG_VERSION      1
+#define BINLOG_DATA_MAX     16      // bytes of the stored value kept per record
+#define BINLOG_LABEL_MAX    16      // label names, incl. the terminating 0
+
+enum BINLOG_KIND {
+    BINLOG_KIND_MEMWRITE_AFTER = 1, // "[MEMWRITE(AFTER)] offset (hitcount) mem sz (stack) -> value"
+    BINLOG_KIND_MEMWRITE_NAMED = 2, // "[MEMWRITE] <label> offset mem sz -> value"
+    BINLOG_KIND_LABEL          = 3, // defines label id -> name (name kept in data[])
+};
+
+struct BINLOG_FILE_HEADER {
+    char     magic[8];      // BINLOG_MAGIC, not 0-terminated
+    uint32_t version;
+    uint32_t recordSize;    // sizeof(BINLOG_RECORD), checked by the decoder
+};
+
+// One fixed-size record per store; 64 bytes so a record never straddles a cache line.
+struct BINLOG_RECORD {
+    uint64_t offset;        // ip - g_addrLow
+    uint64_t addr;          // effective address of the store
+    uint64_t rsp;
+    uint64_t hitcount;
+    uint64_t seq;           // per-thread record number
+    uint16_t size;          // store size in bytes (may exceed BINLOG_DATA_MAX)
+    uint8_t  kind;          // BINLOG_KIND
+    uint8_t  label;         // label id for BINLOG_KIND_MEMWRITE_NAMED
+    uint32_t tid;
+    uint8_t  data[BINLOG_DATA_MAX]; // first bytes of memory after the store
+};
+
+#endif // CS6501_BINLOG_FORMAT_H
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Set-associative L1D / L2 / LLC simulator fed by the main image's memory operands.
+ *
+ *  Memory references are not passed to an analysis call one by one: Instruction()
+ *  inserts INS_InsertFillBuffer for each operand and Pin fills a per-thread trace
+ *  buffer inline; the hierarchy is only simulated when a buffer is full (or the
+ *  thread exits). Misses are counted per image offset of the accessing instruction.
+ *
+ *  Works on any target (flappybird, moon-buggy, mine): copy it next to the tools.
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stddef.h>
+#include "cs6501_report.h"
+#include "cs6501_replay.h"
+#include "cs6501_fastforward.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+ADDRINT g_addrLow, g_addrHigh;
+BOOL g_bMainExecLoaded = FALSE;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobL1D(KNOB_MODE_WRITEONCE, "pintool", "l1d", "32k:8",
+    "L1D <size>:<ways> (k/m suffix), 0 to disable the level");
+KNOB<string> KnobL2(KNOB_MODE_WRITEONCE, "pintool", "l2", "1m:16",
+    "L2 <size>:<ways>, 0 to disable the level");
+KNOB<string> KnobLLC(KNOB_MODE_WRITEONCE, "pintool", "llc", "8m:16",
+    "LLC <size>:<ways>, 0 to disable the level");
+KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool", "line", "64",
+    "line size in bytes (power of two), same for every level");
+KNOB<string> KnobRepl(KNOB_MODE_WRITEONCE, "pintool", "repl", "lru",
+    "replacement policy: lru or plru (tree pseudo-LRU, needs power-of-two ways)");
+KNOB<UINT32> KnobBufPages(KNOB_MODE_WRITEONCE, "pintool", "buf_pages", "64",
+    "4 KB pages per thread trace buffer");
+KNOB<string> KnobOutput(KNOB_MODE_WRITEONCE, "pintool", "o", "cachesim.txt",
+    "report file");
+
+/* ===================================================================== */
+/* Cache Model */
+/* ===================================================================== */
+
+class CACHE_LEVEL
+{
+  public:
+    string name;
+    UINT32 sets, ways;
+    BOOL plru;
+    vector<UINT64> tags;        // sets * ways, ~0 = invalid
+    vector<UINT64> stamps;      // LRU: last use per way
+    vector<UINT64> tree;        // PLRU: one bit per tree node, per set
+    UINT64 clock;
+    UINT64 accesses, misses;
+
+    CACHE_LEVEL(const string& n, UINT32 numSets, UINT32 numWays, BOOL usePlru)
+        : name(n), sets(numSets), ways(numWays), plru(usePlru),
+          tags((size_t)numSets * numWays, ~0ULL), stamps((size_t)numSets * numWays, 0),
+          tree(numSets, 0), clock(0), accesses(0), misses(0) {}
+
+    // line = address >> line shift. Returns TRUE on a hit; a miss fills the line.
+    BOOL Access(UINT64 line)
+    {
+        UINT32 set = line % sets;
+        UINT64* t = &tags[(size_t)set * ways];
+        accesses++;
+
+        UINT32 way;
+        for (way = 0; way < ways; way++) {
+            if (t[way] == line) break;
+        }
+        BOOL hit = way < ways;
+        if (!hit) {
+            misses++;
+            way = Victim(set);
+            t[way] = line;
+        }
+        Touch(set, way);
+        return hit;
+    }
+
+  private:
+    UINT32 Victim(UINT32 set)
+    {
+        const UINT64* t = &tags[(size_t)set * ways];
+        for (UINT32 w = 0; w < ways; w++) {
+            if (t[w] == ~0ULL) return w;
+        }
+        if (plru) {
+            UINT32 node = 1;
+            while (node < ways) node = 2 * node + ((tree[set] >> node) & 1);
+            return node - ways;
+        }
+        const UINT64* s = &stamps[(size_t)set * ways];
+        return (UINT32)(min_element(s, s + ways) - s);
+    }
+
+    VOID Touch(UINT32 set, UINT32 way)
+    {
+        if (!plru) {
+            stamps[(size_t)set * ways + way] = ++clock;
+            return;
+        }
+        // Point every node on the path away from the way just used
+        UINT32 node = way + ways;
+        while (node > 1) {
+            UINT32 parent = node / 2;
+            UINT64 bit = 1ULL << parent;
+            if (node & 1) tree[set] &= ~bit; else tree[set] |= bit;
+            node = parent;
+        }
+    }
+};
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+// One trace buffer element per memory operand executed
+struct MEMREF {
+    ADDRINT offset;     // image offset of the instruction
+    ADDRINT ea;
+    UINT32 size;
+    UINT32 isStore;
+};
+
+vector<CACHE_LEVEL*> g_levels;
+UINT32 g_lineShift = 6;
+BUFFER_ID g_bufId = BUFFER_ID_INVALID;
+PIN_LOCK g_simLock;                     // the hierarchy is shared by all threads
+vector<UINT64> g_offsetAccesses;        // per image offset
+vector<vector<UINT64> > g_offsetMisses; // per level, per image offset
+FILE* g_fpOut = 0;
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool simulates an L1D / L2 / LLC hierarchy and reports misses per instruction offset.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+
+// "<size>[k|m]:<ways>", "0" disables the level.
+BOOL AddLevel(const string& name, const string& spec, UINT32 lineSize, BOOL plru)
+{
+    if (spec == "0") return TRUE;
+
+    char* end;
+    UINT64 size = strtoull(spec.c_str(), &end, 0);
+    if (*end == 'k' || *end == 'K') { size <<= 10; end++; }
+    else if (*end == 'm' || *end == 'M') { size <<= 20; end++; }
+    UINT32 ways = (*end == ':') ? strtoul(end + 1, &end, 0) : 0;
+
+    if (*end != '\0' || size == 0 || ways == 0 || ways > 64 || size % ((UINT64)ways * lineSize) != 0 ||
+        (plru && (ways & (ways - 1)) != 0)) {
+        fprintf(stderr, "[CACHE] bad %s geometry '%s' (size must be ways * line * sets, plru needs power-of-two ways <= 64)\n",
+            name.c_str(), spec.c_str());
+        return FALSE;
+    }
+    g_levels.push_back(new CACHE_LEVEL(name, (UINT32)(size / ways / lineSize), ways, plru));
+    return TRUE;
+}
+
+// Walks the hierarchy until a level hits.
+VOID Simulate(const MEMREF& ref)
+{
+    g_offsetAccesses[ref.offset]++;
+
+    UINT64 first = ref.ea >> g_lineShift;
+    UINT64 last = (ref.ea + (ref.size ? ref.size : 1) - 1) >> g_lineShift;
+    for (UINT64 line = first; line <= last; line++) {
+        for (size_t l = 0; l < g_levels.size(); l++) {
+            if (g_levels[l]->Access(line)) break;
+            g_offsetMisses[l][ref.offset]++;
+        }
+    }
+}
+
+/* ===================================================================== */
+/* Buffer Callback */
+/* ===================================================================== */
+
+VOID* BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 numElements, VOID* v)
+{
+    const MEMREF* refs = static_cast<const MEMREF*>(buf);
+
+    PIN_GetLock(&g_simLock, tid + 1);
+    for (UINT64 i = 0; i < numElements; i++) {
+        Simulate(refs[i]);
+    }
+    PIN_ReleaseLock(&g_simLock);
+    return buf;
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if( IMG_IsMainExecutable(img) ) {
+        g_addrLow = IMG_LowAddress(img); 
+        g_addrHigh = IMG_HighAddress(img);
+        g_offsetAccesses.assign(g_addrHigh - g_addrLow + 1, 0);
+        for (size_t l = 0; l < g_levels.size(); l++) g_offsetMisses[l].assign(g_addrHigh - g_addrLow + 1, 0);
+        g_bMainExecLoaded = TRUE;
+    }
+}
+
+VOID Instruction(INS ins, VOID* v)
+{
+    ADDRINT addr = INS_Address(ins);
+    if (!g_bMainExecLoaded || addr < g_addrLow || addr >= g_addrHigh || !FF_Active()) return;
+
+    ADDRINT offset = addr - g_addrLow;
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        INS_InsertFillBuffer(ins, IPOINT_BEFORE, g_bufId,
+            IARG_ADDRINT, offset, offsetof(MEMREF, offset),
+            IARG_MEMORYOP_EA, memOp, offsetof(MEMREF, ea),
+            IARG_UINT32, (UINT32)INS_MemoryOperandSize(ins, memOp), offsetof(MEMREF, size),
+            IARG_UINT32, (UINT32)INS_MemoryOperandIsWritten(ins, memOp), offsetof(MEMREF, isStore),
+            IARG_END);
+    }
+    if (memOperands) Report_Symbolize(ins, offset);
+}
+
+/* ===================================================================== */
+
+VOID Fini(INT32 code, VOID* v)
+{
+    FILE* fp = g_fpOut;
+
+    FF_Report();
+    fprintf(fp, "[CACHE] line %u, %s\n", KnobLineSize.Value(), KnobRepl.Value().c_str());
+    for (size_t l = 0; l < g_levels.size(); l++) {
+        const CACHE_LEVEL* c = g_levels[l];
+        fprintf(fp, "%s: %u sets x %u ways, accesses: %llu, misses: %llu (%.2f%%)\n", c->name.c_str(), c->sets, c->ways,
+            (unsigned long long)c->accesses, (unsigned long long)c->misses,
+            c->accesses ? 100.0 * c->misses / c->accesses : 0.0);
+    }
+    if (g_levels.empty()) {
+        fclose(fp);
+        return;
+    }
+
+    // Top offsets by first-level misses
+    vector<pair<UINT64, ADDRINT> > hot;
+    for (ADDRINT i = 0; i < g_offsetAccesses.size(); i++) {
+        if (g_offsetMisses[0][i]) hot.push_back(make_pair(g_offsetMisses[0][i], i));
+    }
+    size_t n = KnobTop.Value() ? min<size_t>(KnobTop.Value(), hot.size()) : hot.size();
+    partial_sort(hot.begin(), hot.begin() + n, hot.end(), greater<pair<UINT64, ADDRINT> >());
+
+    fprintf(fp, "\n[MISSES] top %lu of %lu offsets by %s misses\n", (unsigned long)n, (unsigned long)hot.size(),
+        g_levels[0]->name.c_str());
+    for (size_t i = 0; i < n; i++) {
+        ADDRINT offset = hot[i].second;
+        fprintf(fp, "offset: %lx, accesses: %llu", offset, (unsigned long long)g_offsetAccesses[offset]);
+        for (size_t l = 0; l < g_levels.size(); l++) {
+            fprintf(fp, ", %s: %llu", g_levels[l]->name.c_str(), (unsigned long long)g_offsetMisses[l][offset]);
+        }
+        Report_PrintSite(fp, offset);
+    }
+    fclose(fp);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+
+    UINT32 lineSize = KnobLineSize.Value();
+    BOOL plru = KnobRepl.Value() == "plru";
+    if (lineSize == 0 || (lineSize & (lineSize - 1)) != 0 || (!plru && KnobRepl.Value() != "lru") ||
+        !AddLevel("L1D", KnobL1D.Value(), lineSize, plru) ||
+        !AddLevel("L2", KnobL2.Value(), lineSize, plru) ||
+        !AddLevel("LLC", KnobLLC.Value(), lineSize, plru))
+    {
+        return Usage();
+    }
+    g_lineShift = __builtin_ctz(lineSize);
+    g_offsetMisses.resize(g_levels.size());
+
+    g_bufId = PIN_DefineTraceBuffer(sizeof(MEMREF), KnobBufPages.Value(), BufferFull, 0);
+    if (g_bufId == BUFFER_ID_INVALID)
+    {
+        cerr << "Error: could not allocate the trace buffer" << endl;
+        return 1;
+    }
+
+    g_fpOut = fopen(KnobOutput.Value().c_str(), "wt");
+    PIN_InitLock(&g_simLock);
+    if (!FF_Init(g_fpOut))
+    {
+        return Usage();
+    }
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Routine-level call-graph profiler for the main executable (and the libraries
+ *  picked with -libs, e.g. -libs 'libncurses*' for the rendering cost).
+ *
+ *  Each thread keeps a shadow stack (fixed array, allocated at thread start) of
+ *  calling-context tree nodes. Nodes and the (parent, routine) -> child table are
+ *  preallocated too (-cct_nodes), so a call only allocates once a thread has seen
+ *  more distinct call paths than that. Routine entries push, rets pop; both unwind by RSP
+ *  so tail calls and longjmp do not leave stale frames. Every basic block adds its
+ *  instruction count to the node on top of the stack (exclusive count); inclusive
+ *  counts, call counts and the caller -> callee graph are derived at Fini.
+ *
+ *  Output: callgraph.txt (per routine and per edge) and callgraph.folded
+ *  (collapsed stacks: flamegraph.pl callgraph.folded > callgraph.svg).
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include "cs6501_replay.h"
+#include "cs6501_imagemap.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutput(KNOB_MODE_WRITEONCE, "pintool", "o", "callgraph.txt",
+    "routine / edge report");
+KNOB<string> KnobFolded(KNOB_MODE_WRITEONCE, "pintool", "folded", "callgraph.folded",
+    "collapsed-stack output for flame graphs, empty to skip");
+KNOB<UINT32> KnobMaxDepth(KNOB_MODE_WRITEONCE, "pintool", "max_depth", "4096",
+    "shadow stack frames per thread; deeper calls are charged to the deepest frame");
+KNOB<UINT32> KnobCctNodes(KNOB_MODE_WRITEONCE, "pintool", "cct_nodes", "65536",
+    "call-path nodes preallocated per thread; the tables double when they fill up");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+// Calling-context tree node: one per distinct call path.
+struct CCT_NODE {
+    UINT32 rtn;         // index into g_rtnNames
+    UINT32 parent;
+    UINT64 calls;
+    UINT64 self;        // instructions executed with this node on top of the stack
+};
+
+struct FRAME {
+    UINT32 node;
+    ADDRINT rsp;        // RSP at routine entry (points to the return address)
+};
+
+// Open-addressing slot of the child table; key 0 is free (rtn 0 is the root).
+struct CHILD_SLOT {
+    UINT64 key;         // parent << 32 | rtn
+    UINT32 node;
+};
+
+struct CG_THREAD {
+    FRAME* stack;       // stack[0] is the root frame, never popped
+    UINT32 depth;
+    vector<CCT_NODE> nodes;
+    vector<CHILD_SLOT> children;                // 2 slots per reserved node, power of two
+};
+
+vector<string> g_rtnNames(1, "[root]");
+CG_THREAD* g_cgThreads[PIN_MAX_THREADS];
+UINT32 g_maxDepth;          // -max_depth
+UINT32 g_cctNodes;          // -cct_nodes, rounded up to a power of two
+PIN_LOCK g_cgLock;          // guards g_cgThreads registration
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool builds a dynamic call graph of the main executable with inclusive / exclusive instruction counts.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+VOID PIN_FAST_ANALYSIS_CALL CountBbl(THREADID tid, UINT32 numIns)
+{
+    CG_THREAD* t = g_cgThreads[tid];
+    t->nodes[t->stack[t->depth].node].self += numIns;
+}
+
+static inline size_t ChildHash(UINT64 key, size_t mask)
+{
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 20) & mask;
+}
+
+// Slot holding key, or the free slot where it goes.
+static inline CHILD_SLOT& ChildSlot(CG_THREAD* t, UINT64 key)
+{
+    size_t mask = t->children.size() - 1;
+    size_t i = ChildHash(key, mask);
+    while (t->children[i].key != 0 && t->children[i].key != key) i = (i + 1) & mask;
+    return t->children[i];
+}
+
+// More call paths than -cct_nodes: double the node pool and rehash.
+static VOID GrowTables(CG_THREAD* t)
+{
+    size_t slots = t->children.size() * 2;
+    t->nodes.reserve(slots / 2);
+    vector<CHILD_SLOT> old(slots);
+    old.swap(t->children);
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i].key) ChildSlot(t, old[i].key) = old[i];
+    }
+}
+
+// Frames entered at or below rsp have already returned.
+inline VOID Unwind(CG_THREAD* t, ADDRINT rsp)
+{
+    while (t->depth > 0 && t->stack[t->depth].rsp <= rsp) t->depth--;
+}
+
+VOID EnterRtn(THREADID tid, UINT32 rtn, ADDRINT rsp)
+{
+    CG_THREAD* t = g_cgThreads[tid];
+    Unwind(t, rsp);
+    if (t->depth + 1 >= g_maxDepth) return;
+
+    UINT32 parent = t->stack[t->depth].node;
+    UINT64 key = ((UINT64)parent << 32) | rtn;
+    CHILD_SLOT* slot = &ChildSlot(t, key);
+    if (slot->key == 0) {
+        // First time on this call path: takes a preallocated node
+        if (t->nodes.size() * 2 >= t->children.size()) {
+            GrowTables(t);
+            slot = &ChildSlot(t, key);
+        }
+        CCT_NODE n = { rtn, parent, 0, 0 };
+        slot->key = key;
+        slot->node = t->nodes.size();
+        t->nodes.push_back(n);
+    }
+    t->nodes[slot->node].calls++;
+    UINT32 node = slot->node;
+
+    t->depth++;
+    t->stack[t->depth].node = node;
+    t->stack[t->depth].rsp = rsp;
+}
+
+VOID LeaveRtn(THREADID tid, ADDRINT rsp)
+{
+    Unwind(g_cgThreads[tid], rsp);
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    CG_THREAD* t = new CG_THREAD();
+    t->stack = new FRAME[g_maxDepth + 1];
+    t->stack[0].node = 0;
+    t->stack[0].rsp = ~(ADDRINT)0;
+    t->depth = 0;
+    CCT_NODE root = { 0, 0, 0, 0 };
+    t->nodes.reserve(g_cctNodes);
+    t->nodes.push_back(root);
+    t->children.resize(g_cctNodes * 2);
+
+    PIN_GetLock(&g_cgLock, tid + 1);
+    g_cgThreads[tid] = t;
+    PIN_ReleaseLock(&g_cgLock);
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+VOID Routine(RTN rtn, VOID* v)
+{
+    SEC sec = RTN_Sec(rtn);
+    IMG img = SEC_Img(sec);
+    if (!ImageMap_WantImage(img) || SEC_Name(sec).compare(0, 4, ".plt") == 0) return;
+
+    // Library routines are shown as image`routine
+    UINT32 id = g_rtnNames.size();
+    string name = PIN_UndecorateSymbolName(RTN_Name(rtn), UNDECORATION_NAME_ONLY);
+    g_rtnNames.push_back(IMG_IsMainExecutable(img) ? name : ImageMap_ShortName(IMG_Name(img)) + "`" + name);
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)EnterRtn,
+        IARG_CALL_ORDER, CALL_ORDER_FIRST,
+        IARG_THREAD_ID, IARG_UINT32, id, IARG_REG_VALUE, REG_RSP, IARG_END);
+    for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
+        if (INS_IsRet(ins)) {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)LeaveRtn, IARG_THREAD_ID, IARG_REG_VALUE, REG_RSP, IARG_END);
+        }
+    }
+    RTN_Close(rtn);
+}
+
+VOID Trace(TRACE trace, VOID* v)
+{
+    if (!ImageMap_Instrumented(TRACE_Address(trace))) return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_FAST_ANALYSIS_CALL,
+            IARG_CALL_ORDER, CALL_ORDER_LAST,
+            IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+    }
+}
+
+/* ===================================================================== */
+/* Report */
+/* ===================================================================== */
+
+struct RTN_STAT {
+    UINT64 calls, self, inclusive;
+};
+
+// Inclusive counts per node (children always come after their parent in nodes[]).
+vector<UINT64> NodeInclusive(const CG_THREAD* t)
+{
+    vector<UINT64> incl(t->nodes.size());
+    for (size_t i = 0; i < t->nodes.size(); i++) incl[i] = t->nodes[i].self;
+    for (size_t i = t->nodes.size() - 1; i > 0; i--) incl[t->nodes[i].parent] += incl[i];
+    return incl;
+}
+
+// A routine's inclusive count only takes the outermost node of a recursion.
+BOOL OnPathAbove(const CG_THREAD* t, UINT32 node, UINT32 rtn)
+{
+    for (UINT32 n = t->nodes[node].parent; n != 0; n = t->nodes[n].parent) {
+        if (t->nodes[n].rtn == rtn) return TRUE;
+    }
+    return FALSE;
+}
+
+string NodePath(const CG_THREAD* t, UINT32 node)
+{
+    if (node == 0) return "";
+    string parent = NodePath(t, t->nodes[node].parent);
+    return parent.empty() ? g_rtnNames[t->nodes[node].rtn] : parent + ";" + g_rtnNames[t->nodes[node].rtn];
+}
+
+bool CompareInclusive(const pair<UINT32, RTN_STAT>& a, const pair<UINT32, RTN_STAT>& b)
+{
+    return a.second.inclusive > b.second.inclusive;
+}
+
+VOID Fini(INT32 code, VOID* v)
+{
+    vector<RTN_STAT> rtns(g_rtnNames.size(), RTN_STAT());
+    map<pair<UINT32, UINT32>, UINT64> edges;   // (caller, callee) -> calls
+    map<string, UINT64> folded;
+    UINT64 total = 0;
+
+    for (UINT32 tid = 0; tid < PIN_MAX_THREADS; tid++) {
+        const CG_THREAD* t = g_cgThreads[tid];
+        if (t == 0) continue;
+
+        vector<UINT64> incl = NodeInclusive(t);
+        total += incl[0];
+        for (UINT32 i = 0; i < t->nodes.size(); i++) {
+            const CCT_NODE& n = t->nodes[i];
+            rtns[n.rtn].calls += n.calls;
+            rtns[n.rtn].self += n.self;
+            if (i != 0 && !OnPathAbove(t, i, n.rtn)) rtns[n.rtn].inclusive += incl[i];
+            if (i != 0) edges[make_pair(t->nodes[n.parent].rtn, n.rtn)] += n.calls;
+            if (n.self && !KnobFolded.Value().empty()) folded[i == 0 ? g_rtnNames[0] : NodePath(t, i)] += n.self;
+        }
+    }
+
+    FILE* fp = fopen(KnobOutput.Value().c_str(), "wt");
+    vector<pair<UINT32, RTN_STAT> > sorted;
+    for (UINT32 r = 1; r < rtns.size(); r++) {
+        if (rtns[r].calls || rtns[r].self) sorted.push_back(make_pair(r, rtns[r]));
+    }
+    sort(sorted.begin(), sorted.end(), CompareInclusive);
+
+    fprintf(fp, "[ROUTINES] %llu instructions in the instrumented images (%llu outside any routine)\n",
+        (unsigned long long)total, (unsigned long long)rtns[0].self);
+    for (size_t i = 0; i < sorted.size(); i++) {
+        const RTN_STAT& s = sorted[i].second;
+        fprintf(fp, "%-32s calls: %llu, inclusive: %llu (%.1f%%), exclusive: %llu (%.1f%%)\n",
+            g_rtnNames[sorted[i].first].c_str(), (unsigned long long)s.calls,
+            (unsigned long long)s.inclusive, total ? 100.0 * s.inclusive / total : 0.0,
+            (unsigned long long)s.self, total ? 100.0 * s.self / total : 0.0);
+    }
+
+    fprintf(fp, "\n[EDGES] caller -> callee: calls\n");
+    for (map<pair<UINT32, UINT32>, UINT64>::iterator it = edges.begin(); it != edges.end(); ++it) {
+        fprintf(fp, "%s -> %s: %llu\n", g_rtnNames[it->first.first].c_str(), g_rtnNames[it->first.second].c_str(),
+            (unsigned long long)it->second);
+    }
+    fclose(fp);
+
+    if (!KnobFolded.Value().empty()) {
+        fp = fopen(KnobFolded.Value().c_str(), "wt");
+        for (map<string, UINT64>::iterator it = folded.begin(); it != folded.end(); ++it) {
+            fprintf(fp, "%s %llu\n", it->first.c_str(), (unsigned long long)it->second);
+        }
+        fclose(fp);
+    }
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+
+    PIN_InitLock(&g_cgLock);
+    g_maxDepth = max<UINT32>(KnobMaxDepth.Value(), 2);
+    for (g_cctNodes = 64; g_cctNodes < KnobCctNodes.Value() && g_cctNodes < (1u << 30); g_cctNodes *= 2);
+
+    ImageMap_Init();
+    RTN_AddInstrumentFunction(Routine, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,3 @@
+# ./cs6501_dirty.sh mark [label] | quiet | forget
+echo "$*" > dirty.cmd
+cat dirty.out
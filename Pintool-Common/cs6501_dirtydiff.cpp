@@ -0,0 +1,450 @@
+/*! @file
+ *  Dirty-page change detector: finds the variables a game writes between two
+ *  moments without instrumenting a single store.
+ *
+ *      ./cs6501_dirtydiff -- ./flappybird          run the game under the detector
+ *      ./cs6501_dirtydiff -p <pid>                 or attach to a running one
+ *
+ *  Commands go through the named pipe dirty.cmd, answers come back through
+ *  dirty.out (cs6501_dirty.sh does both):
+ *
+ *      ./cs6501_dirty.sh mark            baseline of every writable private mapping
+ *      ./cs6501_dirty.sh quiet           ... nothing happened: what changed is noise
+ *      ./cs6501_dirty.sh mark collide    ... collided: the words that changed
+ *
+ *  A mark stops the target with ptrace (PTRACE_SEIZE + PTRACE_INTERRUPT), clears
+ *  the soft-dirty bits (/proc/pid/clear_refs) and copies the pages. The next mark
+ *  only reads the pages /proc/pid/pagemap reports as soft-dirty and compares them
+ *  word by word (4 bytes) with the copy. Only the stopped thread is frozen; the
+ *  games are single-threaded. Without soft-dirty support every page is compared.
+ *
+ *  Addresses in an image's .data / .bss are also shown as image+offset, the same
+ *  offsets the Pin tools and the .S listings use.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define PAGEMAP_SOFT_DIRTY  (1ULL << 55)
+#define PAGEMAP_PRESENT     (1ULL << 63)
+#define PAGEMAP_SWAPPED     (1ULL << 62)
+
+// One writable private mapping and its copy from the last mark.
+struct REGION {
+    uint64_t start, end;
+    string name;            // image file name, [heap], [stack], or "anon"
+    uint64_t imageBase;     // image offsets = addr - imageBase, 0 if not part of an image
+    vector<uint8_t> copy;
+};
+
+static pid_t g_pid;
+static bool g_child = false;        // started by us, not attached with -p
+static int g_memFd = -1, g_pagemapFd = -1;
+static bool g_softDirty = true;
+static uint64_t g_pageSize;
+static map<uint64_t, REGION> g_regions;     // by start
+static set<uint64_t> g_noise;               // words that changed in a "quiet" mark
+static int g_marks = 0;
+static unsigned g_listMax = 200;
+static const char* g_cmdPipe = "dirty.cmd";
+static const char* g_outPipe = "dirty.out";
+static volatile sig_atomic_t g_stop = 0;
+
+static string BaseName(const string& path)
+{
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+// Writable private mappings of the target, as in /proc/pid/maps.
+static bool ReadMaps(vector<REGION>& regions)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", g_pid);
+    FILE* fp = fopen(path, "rt");
+    if (fp == 0) return false;
+
+    map<string, uint64_t> bases;    // lowest start - file offset per image
+    string prevName;
+    uint64_t prevEnd = 0, prevBase = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long start, end, offset;
+        char perms[8], file[400] = "";
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %399[^\n]", &start, &end, perms, &offset, file) < 4) continue;
+
+        string name = file;
+        uint64_t base = 0;
+        if (!name.empty() && name[0] == '/') {
+            if (bases.find(name) == bases.end()) bases[name] = start - offset;
+            base = bases[name];
+            name = BaseName(name);
+        }
+        else if (name.empty() && start == prevEnd && prevBase) {
+            name = prevName;    // .bss past the end of the file-backed .data
+            base = prevBase;
+        }
+        prevName = name;
+        prevEnd = end;
+        prevBase = base;
+
+        if (perms[1] != 'w' || perms[3] != 'p' || name == "[vvar]" || name == "[vsyscall]") continue;
+        REGION r;
+        r.start = start;
+        r.end = end;
+        r.name = name.empty() ? "anon" : name;
+        r.imageBase = base;
+        regions.push_back(r);
+    }
+    fclose(fp);
+    return true;
+}
+
+// Reads [addr, addr + len) page by page; unreadable pages come back as zeros.
+static void ReadMem(uint64_t addr, uint8_t* buf, uint64_t len)
+{
+    if (pread(g_memFd, buf, len, addr) == (ssize_t)len) return;
+    for (uint64_t off = 0; off < len; off += g_pageSize) {
+        if (pread(g_memFd, buf + off, g_pageSize, addr + off) != (ssize_t)g_pageSize) {
+            memset(buf + off, 0, g_pageSize);
+        }
+    }
+}
+
+static bool ClearSoftDirty(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+    int fd = open(path, O_WRONLY);
+    bool ok = fd >= 0 && write(fd, "4", 1) == 1;
+    if (fd >= 0) close(fd);
+    return ok;
+}
+
+// Kernels without CONFIG_MEM_SOFT_DIRTY accept clear_refs but never set the bit:
+// try it on one of our own pages.
+static bool SoftDirtyWorks()
+{
+    static volatile uint8_t probe[1 << 16];
+    uint64_t addr = ((uint64_t)probe + g_pageSize) & ~(g_pageSize - 1);
+    ((volatile uint8_t*)addr)[0] = 1;
+    if (!ClearSoftDirty(getpid())) return false;
+    ((volatile uint8_t*)addr)[0] = 2;
+
+    uint64_t entry = 0;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    bool ok = fd >= 0 && pread(fd, &entry, 8, (addr / g_pageSize) * 8) == 8 && (entry & PAGEMAP_SOFT_DIRTY);
+    if (fd >= 0) close(fd);
+    return ok;
+}
+
+/* ===================================================================== */
+/* Stopping the target */
+/* ===================================================================== */
+
+// Stops the target; a signal that arrives meanwhile is returned through *pendingSig.
+static bool StopTarget(int* pendingSig)
+{
+    *pendingSig = 0;
+    if (ptrace(PTRACE_SEIZE, g_pid, 0, 0) != 0 || ptrace(PTRACE_INTERRUPT, g_pid, 0, 0) != 0) {
+        return false;
+    }
+    for (;;) {
+        int status;
+        if (waitpid(g_pid, &status, __WALL) != g_pid || !WIFSTOPPED(status)) return false;
+        if ((status >> 16) == PTRACE_EVENT_STOP) return true;
+        // Signal-delivery stop before our interrupt: hold the signal back for the
+        // detach and let the target run into the interrupt that is still pending
+        *pendingSig = WSTOPSIG(status);
+        if (ptrace(PTRACE_CONT, g_pid, 0, 0) != 0) return false;
+    }
+}
+
+static void ResumeTarget(int pendingSig)
+{
+    ptrace(PTRACE_DETACH, g_pid, 0, (void*)(long)pendingSig);
+}
+
+/* ===================================================================== */
+/* Marks */
+/* ===================================================================== */
+
+static void PrintAddr(FILE* out, const REGION& r, uint64_t addr)
+{
+    uint64_t base = r.imageBase ? r.imageBase : r.start;
+    fprintf(out, "%#14lx  %s+%#lx", (unsigned long)addr, r.name.c_str(), (unsigned long)(addr - base));
+}
+
+// Compares the soft-dirty pages of r with its copy and refreshes the copy.
+// Changed words are reported (up to g_listMax) unless noise, or added to the noise.
+static void DiffRegion(FILE* out, REGION& r, bool quiet, unsigned* pages, unsigned* changed)
+{
+    uint64_t npages = (r.end - r.start) / g_pageSize;
+    vector<uint64_t> pm(npages);
+    bool havePagemap = g_softDirty &&
+        pread(g_pagemapFd, &pm[0], npages * 8, (r.start / g_pageSize) * 8) == (ssize_t)(npages * 8);
+
+    vector<uint8_t> page(g_pageSize);
+    for (uint64_t p = 0; p < npages; p++) {
+        if (havePagemap && !(pm[p] & PAGEMAP_SOFT_DIRTY)) continue;
+        if (havePagemap && !(pm[p] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))) continue;
+        uint64_t addr = r.start + p * g_pageSize;
+        uint8_t* copy = &r.copy[p * g_pageSize];
+        ReadMem(addr, &page[0], g_pageSize);
+        (*pages)++;
+
+        for (uint64_t off = 0; off < g_pageSize; off += 4) {
+            int32_t oldVal, newVal;
+            memcpy(&oldVal, copy + off, 4);
+            memcpy(&newVal, &page[off], 4);
+            if (oldVal == newVal) continue;
+            if (quiet) {
+                g_noise.insert(addr + off);
+                continue;
+            }
+            if (g_noise.count(addr + off)) continue;
+            if ((*changed)++ < g_listMax) {
+                fprintf(out, "  ");
+                PrintAddr(out, r, addr + off);
+                fprintf(out, ": %d -> %d (%#x -> %#x)\n", oldVal, newVal, (uint32_t)oldVal, (uint32_t)newVal);
+            }
+        }
+        memcpy(copy, &page[0], g_pageSize);
+    }
+}
+
+static void Mark(FILE* out, const char* label, bool quiet)
+{
+    int pendingSig;
+    if (!StopTarget(&pendingSig)) {
+        fprintf(out, "[DIRTY] cannot stop pid %d: %s\n", g_pid, strerror(errno));
+        return;
+    }
+
+    // Opened per mark: a descriptor opened before the child's exec sees the old mm
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/mem", g_pid);
+    g_memFd = open(path, O_RDONLY);
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", g_pid);
+    g_pagemapFd = open(path, O_RDONLY);
+    if (g_memFd < 0 || g_pagemapFd < 0) {
+        fprintf(out, "[DIRTY] cannot open /proc/%d/mem or pagemap: %s\n", g_pid, strerror(errno));
+        if (g_memFd >= 0) close(g_memFd);
+        if (g_pagemapFd >= 0) close(g_pagemapFd);
+        ResumeTarget(pendingSig);
+        return;
+    }
+
+    vector<REGION> now;
+    ReadMaps(now);
+    g_marks++;
+    fprintf(out, "[MARK %d]%s%s\n", g_marks, *label ? " " : "", label);
+
+    // Regions that are gone are dropped, new ones (or the pages a region grew by) are copied whole
+    map<uint64_t, REGION> next;
+    unsigned dirtyPages = 0, changed = 0, newPages = 0;
+    uint64_t totalPages = 0;
+    for (size_t i = 0; i < now.size(); i++) {
+        REGION& r = now[i];
+        totalPages += (r.end - r.start) / g_pageSize;
+        vector<bool> have((r.end - r.start) / g_pageSize, false);
+        r.copy.resize(r.end - r.start);
+
+        // Whatever overlaps r under the same name is r from the last mark, moved at
+        // either end: [stack] grows its start down, [heap] its end up
+        map<uint64_t, REGION>::iterator it = g_regions.lower_bound(r.end);
+        while (it != g_regions.begin()) {
+            --it;
+            REGION& old = it->second;
+            if (old.end <= r.start) break;
+            if (old.name != r.name) continue;
+            REGION both;
+            both.start = max(r.start, old.start);
+            both.end = min(r.end, old.end);
+            both.name = r.name;
+            both.imageBase = r.imageBase;
+            both.copy.assign(old.copy.begin() + (both.start - old.start), old.copy.begin() + (both.end - old.start));
+            if (g_marks > 1) DiffRegion(out, both, quiet, &dirtyPages, &changed);
+            memcpy(&r.copy[both.start - r.start], &both.copy[0], both.end - both.start);
+            for (uint64_t a = both.start; a < both.end; a += g_pageSize) have[(a - r.start) / g_pageSize] = true;
+        }
+        for (uint64_t p = 0; p < have.size(); p++) {
+            if (have[p]) continue;
+            ReadMem(r.start + p * g_pageSize, &r.copy[p * g_pageSize], g_pageSize);
+            newPages++;
+        }
+        next[r.start].copy.swap(r.copy);
+        REGION& kept = next[r.start];
+        kept.start = r.start;
+        kept.end = r.end;
+        kept.name = r.name;
+        kept.imageBase = r.imageBase;
+    }
+    g_regions.swap(next);
+
+    // Written from here on is dirty at the next mark
+    if (g_softDirty && !ClearSoftDirty(g_pid)) {
+        fprintf(out, "[DIRTY] cannot clear soft-dirty bits (%s), comparing every page from now on\n", strerror(errno));
+        g_softDirty = false;
+    }
+    close(g_memFd);
+    close(g_pagemapFd);
+    ResumeTarget(pendingSig);
+
+    if (g_marks == 1) {
+        fprintf(out, "  baseline: %lu pages in %lu writable mappings\n", (unsigned long)totalPages, (unsigned long)now.size());
+    }
+    else if (quiet) {
+        fprintf(out, "  %u dirty pages of %lu, %lu words are noise now\n", dirtyPages, (unsigned long)totalPages, (unsigned long)g_noise.size());
+    }
+    else {
+        if (changed > g_listMax) fprintf(out, "  ... %u more\n", changed - g_listMax);
+        fprintf(out, "  %u dirty pages of %lu, %u words changed, %u new pages\n", dirtyPages, (unsigned long)totalPages, changed, newPages);
+    }
+}
+
+/* ===================================================================== */
+/* Command pipe */
+/* ===================================================================== */
+
+// The answer pipe is opened per command; give the client a moment to open its end.
+static FILE* OpenAnswerPipe()
+{
+    for (int i = 0; i < 200 && !g_stop; i++) {
+        int fd = open(g_outPipe, O_WRONLY | O_NONBLOCK);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fdopen(fd, "w");
+        }
+        usleep(10000);
+    }
+    return 0;
+}
+
+static void Command(char* line)
+{
+    char* cmd = strtok(line, " \t\r");
+    char* arg = strtok(0, "\r");
+    if (cmd == 0) return;
+
+    FILE* fp = OpenAnswerPipe();
+    FILE* out = fp ? fp : stderr;
+    if (strcmp(cmd, "mark") == 0) Mark(out, arg ? arg : "", false);
+    else if (strcmp(cmd, "quiet") == 0) Mark(out, arg ? arg : "quiet", g_marks > 0);
+    else if (strcmp(cmd, "forget") == 0) {
+        g_noise.clear();
+        fprintf(out, "[DIRTY] noise cleared\n");
+    }
+    else fprintf(out, "[DIRTY] commands: mark [label] | quiet | forget\n");
+    if (fp) fclose(fp);
+}
+
+static bool TargetAlive()
+{
+    if (g_child) {
+        int status;
+        return waitpid(g_pid, &status, WNOHANG) == 0;
+    }
+    return kill(g_pid, 0) == 0;
+}
+
+static void OnSignal(int) { g_stop = 1; }
+
+// Removes a FIFO left behind by an earlier run; anything else at path is not ours to replace.
+static bool RemoveFifo(const char* path)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) return true;
+        fprintf(stderr, "[DIRTY] cannot stat %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!S_ISFIFO(st.st_mode)) {
+        fprintf(stderr, "[DIRTY] %s exists and is not a FIFO, not replacing it\n", path);
+        return false;
+    }
+    return unlink(path) == 0;
+}
+
+static int Usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-cmd dirty.cmd] [-out dirty.out] [-list_max 200] (-p pid | -- program args...)\n", argv0);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int i;
+    g_pid = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) break;
+        if (i + 1 >= argc) return Usage(argv[0]);
+        if (strcmp(argv[i], "-p") == 0) g_pid = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cmd") == 0) g_cmdPipe = argv[++i];
+        else if (strcmp(argv[i], "-out") == 0) g_outPipe = argv[++i];
+        else if (strcmp(argv[i], "-list_max") == 0) g_listMax = atoi(argv[++i]);
+        else return Usage(argv[0]);
+    }
+    if ((g_pid == 0) == (i + 1 >= argc)) return Usage(argv[0]);
+
+    if (!RemoveFifo(g_cmdPipe) || !RemoveFifo(g_outPipe)) return 1;
+    if (mkfifo(g_cmdPipe, 0600) != 0 || mkfifo(g_outPipe, 0600) != 0) {
+        fprintf(stderr, "[DIRTY] cannot create %s / %s\n", g_cmdPipe, g_outPipe);
+        return 1;
+    }
+
+    if (g_pid == 0) {
+        g_child = true;
+        g_pid = fork();
+        if (g_pid == 0) {
+            execvp(argv[i + 1], argv + i + 1);
+            perror(argv[i + 1]);
+            _exit(127);
+        }
+    }
+    g_pageSize = sysconf(_SC_PAGESIZE);
+    if (!SoftDirtyWorks()) {
+        fprintf(stderr, "[DIRTY] no soft-dirty bits on this kernel, every page is compared at a mark\n");
+        g_softDirty = false;
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    int fd = open(g_cmdPipe, O_RDONLY | O_NONBLOCK);
+    string pending;
+    char buf[256];
+    while (!g_stop && TargetAlive()) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            usleep(20000);  // no writer or nothing to read yet
+            continue;
+        }
+        pending.append(buf, n);
+
+        size_t eol;
+        while ((eol = pending.find('\n')) != string::npos) {
+            string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            Command(&line[0]);
+        }
+    }
+    close(fd);
+    unlink(g_cmdPipe);
+    unlink(g_outPipe);
+    return 0;
+}
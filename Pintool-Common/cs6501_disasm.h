@@ -0,0 +1,65 @@
+/*! @file
+ *  Lazy, cached disassembly for the cs6501 Pin tools' Instruction() callbacks.
+ *
+ *  INS_Disassemble() is only called when a [Read/Parse/Translate] line is actually
+ *  written, and the text is cached by image offset, so re-JIT after a code-cache
+ *  flush does not disassemble the same instruction again.
+ */
+
+#ifndef CS6501_DISASM_H
+#define CS6501_DISASM_H
+
+#include "pin.H"
+#include <map>
+#include <string>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<UINT32> KnobJitLog(KNOB_MODE_WRITEONCE, "pintool", "jitlog", "1",
+    "[Read/Parse/Translate] lines: 0 none, 1 instrumented instructions, 2 every main-image instruction");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+static std::map<ADDRINT, std::string> g_disasmCache;   // image offset -> INS_Disassemble text
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Instrumentation time only (Pin holds the client lock).
+const std::string& Disasm_Get(INS ins, ADDRINT offset)
+{
+    std::map<ADDRINT, std::string>::iterator it = g_disasmCache.find(offset);
+    if (it == g_disasmCache.end()) {
+        it = g_disasmCache.insert(std::make_pair(offset, INS_Disassemble(ins))).first;
+    }
+    return it->second;
+}
+
+// For reports written after the run: "" if the offset was never disassembled.
+const char* Disasm_Lookup(ADDRINT offset)
+{
+    std::map<ADDRINT, std::string>::iterator it = g_disasmCache.find(offset);
+    return it == g_disasmCache.end() ? "" : it->second.c_str();
+}
+
+VOID Disasm_LogTranslate(FILE* fp, INS ins, ADDRINT offset, BOOL instrumented)
+{
+    UINT32 level = KnobJitLog.Value();
+    if (level == 0 || (level == 1 && !instrumented)) return;
+
+    fprintf(fp, "[Read/Parse/Translate] [%lx] %s\n", offset, Disasm_Get(ins, offset).c_str());
+}
+
+// Replaces strstr(INS_Disassemble(ins), "push r"): a register push only spills a
+// register to the stack. Pushes of an immediate or of memory are still recorded.
+inline BOOL IsPushInst(INS ins)
+{
+    return INS_Opcode(ins) == XED_ICLASS_PUSH && INS_OperandIsReg(ins, 0);
+}
+
+#endif // CS6501_DISASM_H
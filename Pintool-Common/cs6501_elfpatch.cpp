@@ -0,0 +1,223 @@
+/*! @file
+ *  Static patcher: applies a patch spec (cs6501_patchspec.h) to a copy of the
+ *  main ELF, so a cheat found with a Pin tool runs natively at full speed:
+ *
+ *      ./cs6501_elfpatch moon-buggy.patch moon-buggy moon-buggy-patched
+ *
+ *  jump, nop and imm patches are written into the bytes of the executable
+ *  segment; skip is turned into a NOP run over the instruction (needs expect,
+ *  which gives its length). setreg changes a register between two instructions
+ *  and has no byte form: it is reported and left to the Pin tool.
+ *
+ *  Offsets are relative to the lowest PT_LOAD address, the same base Pin uses
+ *  for IMG_LowAddress, and symbols are looked up in .symtab (then .dynsym).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "cs6501_patchspec.h"
+
+static std::vector<uint8_t> g_elf;
+static const Elf64_Ehdr* g_ehdr;
+static uint64_t g_base;     // lowest PT_LOAD vaddr
+
+static bool ReadFile(const char* path, std::vector<uint8_t>& data)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == 0) {
+        perror(path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    data.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    bool ok = data.empty() || fread(&data[0], data.size(), 1, fp) == 1;
+    fclose(fp);
+    return ok;
+}
+
+static const Elf64_Phdr* Phdr(int i)
+{
+    return (const Elf64_Phdr*)&g_elf[g_ehdr->e_phoff + i * g_ehdr->e_phentsize];
+}
+
+static const Elf64_Shdr* Shdr(int i)
+{
+    return (const Elf64_Shdr*)&g_elf[g_ehdr->e_shoff + i * g_ehdr->e_shentsize];
+}
+
+static bool CheckElf(const char* path)
+{
+    if (g_elf.size() < sizeof(Elf64_Ehdr)) {
+        fprintf(stderr, "%s: not a 64-bit little-endian ELF\n", path);
+        return false;
+    }
+    g_ehdr = (const Elf64_Ehdr*)&g_elf[0];
+    if (memcmp(g_ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        g_ehdr->e_ident[EI_CLASS] != ELFCLASS64 || g_ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+        g_ehdr->e_phoff + (uint64_t)g_ehdr->e_phnum * g_ehdr->e_phentsize > g_elf.size() ||
+        g_ehdr->e_shoff + (uint64_t)g_ehdr->e_shnum * g_ehdr->e_shentsize > g_elf.size()) {
+        fprintf(stderr, "%s: not a 64-bit little-endian ELF\n", path);
+        return false;
+    }
+
+    g_base = ~0ULL;
+    for (int i = 0; i < g_ehdr->e_phnum; i++) {
+        if (Phdr(i)->p_type == PT_LOAD && Phdr(i)->p_vaddr < g_base) g_base = Phdr(i)->p_vaddr;
+    }
+    if (g_base == ~0ULL) {
+        fprintf(stderr, "%s: no PT_LOAD segment\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Image offset of a symbol, searched in the first symbol table of type 'type'.
+static bool FindSymbol(uint32_t type, const std::string& name, uint64_t* offset)
+{
+    for (int i = 0; i < g_ehdr->e_shnum; i++) {
+        const Elf64_Shdr* symtab = Shdr(i);
+        if (symtab->sh_type != type || symtab->sh_link >= g_ehdr->e_shnum) continue;
+        const Elf64_Shdr* strtab = Shdr(symtab->sh_link);
+        if (symtab->sh_offset + symtab->sh_size > g_elf.size() || strtab->sh_offset + strtab->sh_size > g_elf.size()) continue;
+
+        const Elf64_Sym* syms = (const Elf64_Sym*)&g_elf[symtab->sh_offset];
+        const char* strs = (const char*)&g_elf[strtab->sh_offset];
+        for (size_t s = 0; s < symtab->sh_size / sizeof(Elf64_Sym); s++) {
+            if (syms[s].st_name < strtab->sh_size && syms[s].st_shndx != SHN_UNDEF && syms[s].st_value &&
+                name == strs + syms[s].st_name) {
+                *offset = syms[s].st_value - g_base;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool ResolveLoc(const PATCH_LOC& loc, uint64_t* offset)
+{
+    if (loc.symbol.empty()) {
+        *offset = loc.offset;
+        return true;
+    }
+    uint64_t sym;
+    if (!FindSymbol(SHT_SYMTAB, loc.symbol, &sym) && !FindSymbol(SHT_DYNSYM, loc.symbol, &sym)) return false;
+    *offset = sym + loc.offset;
+    return true;
+}
+
+// File position of [offset, offset + size) if it lies inside one executable segment.
+static bool CodeToFile(uint64_t offset, uint64_t size, uint64_t* filePos)
+{
+    uint64_t vaddr = g_base + offset;
+    for (int i = 0; i < g_ehdr->e_phnum; i++) {
+        const Elf64_Phdr* ph = Phdr(i);
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X) &&
+            ph->p_vaddr <= vaddr && vaddr + size <= ph->p_vaddr + ph->p_filesz) {
+            *filePos = ph->p_offset + (vaddr - ph->p_vaddr);
+            return *filePos + size <= g_elf.size();
+        }
+    }
+    return false;
+}
+
+static void PrintBytes(const uint8_t* bytes, size_t n)
+{
+    for (size_t i = 0; i < n; i++) printf("%02x", bytes[i]);
+}
+
+// Returns 0 applied, 1 left to the Pin tool, -1 error.
+static int Apply(const char* specPath, const PATCH_SPEC& spec)
+{
+    uint64_t offset, target = 0;
+    if (!ResolveLoc(spec.where, &offset) || (spec.action == PATCH_JUMP && !ResolveLoc(spec.target, &target))) {
+        fprintf(stderr, "[PATCH] %s:%d: symbol not found\n", specPath, spec.line);
+        return -1;
+    }
+
+    PATCH_SPEC patch = spec;
+    if (spec.action == PATCH_SETREG) {
+        printf("[PATCH] line %d: offset %lx: setreg has no byte form, use the Pin tool\n", spec.line, (unsigned long)offset);
+        return 1;
+    }
+    if (spec.action == PATCH_SKIP) {
+        if (spec.expect.empty()) {
+            fprintf(stderr, "[PATCH] %s:%d: skip needs 'expect <bytes>' for the instruction length\n", specPath, spec.line);
+            return -1;
+        }
+        patch.action = PATCH_NOP;
+        patch.length = spec.expect.size();
+    }
+
+    std::vector<uint8_t> bytes;
+    PatchSpec_Encode(patch, offset, target, bytes);
+    uint64_t checked = spec.expect.size() > bytes.size() ? spec.expect.size() : bytes.size();
+    uint64_t filePos;
+    if (!CodeToFile(offset, checked, &filePos)) {
+        fprintf(stderr, "[PATCH] %s:%d: offset %lx is not in an executable segment\n", specPath, spec.line, (unsigned long)offset);
+        return -1;
+    }
+
+    uint8_t* code = &g_elf[filePos];
+    if (!spec.expect.empty() && memcmp(code, &spec.expect[0], spec.expect.size()) != 0) {
+        fprintf(stderr, "[PATCH] %s:%d: offset %lx is ", specPath, spec.line, (unsigned long)offset);
+        for (size_t i = 0; i < spec.expect.size(); i++) fprintf(stderr, "%02x", code[i]);
+        fprintf(stderr, ", expected ");
+        for (size_t i = 0; i < spec.expect.size(); i++) fprintf(stderr, "%02x", spec.expect[i]);
+        fprintf(stderr, "\n");
+        return -1;
+    }
+
+    // IMM leaves the opcode and operand bytes in front of the immediate alone
+    size_t first = spec.action == PATCH_IMM ? spec.pos : 0;
+    printf("[PATCH] line %d: offset %lx: ", spec.line, (unsigned long)offset);
+    PrintBytes(code, bytes.size());
+    printf(" -> ");
+    memcpy(code + first, &bytes[first], bytes.size() - first);
+    PrintBytes(code, bytes.size());
+    if (!spec.expect.empty() && bytes.size() > spec.expect.size()) {
+        printf(" (overwrites %lu bytes past the instruction)", (unsigned long)(bytes.size() - spec.expect.size()));
+    }
+    printf("\n");
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s spec.patch input-elf output-elf\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<PATCH_SPEC> specs;
+    if (!PatchSpec_Load(argv[1], specs) || !ReadFile(argv[2], g_elf) || !CheckElf(argv[2])) {
+        return 1;
+    }
+
+    int errors = 0, applied = 0, dynamicOnly = 0;
+    for (size_t i = 0; i < specs.size(); i++) {
+        int rc = Apply(argv[1], specs[i]);
+        if (rc < 0) errors++;
+        else if (rc == 0) applied++;
+        else dynamicOnly++;
+    }
+    if (errors) {
+        fprintf(stderr, "%d patch(es) failed, %s not written\n", errors, argv[3]);
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[3], "wb");
+    if (fp == 0 || fwrite(&g_elf[0], g_elf.size(), 1, fp) != 1 || fclose(fp) != 0) {
+        perror(argv[3]);
+        return 1;
+    }
+    struct stat st;
+    if (stat(argv[2], &st) == 0) chmod(argv[3], st.st_mode & 07777);
+
+    printf("%s: %d patch(es) applied, %d left to the Pin tool\n", argv[3], applied, dynamicOnly);
+    return 0;
+}
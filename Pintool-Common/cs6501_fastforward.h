@@ -0,0 +1,283 @@
+/*! @file
+ *  Fast-forward mode for the cs6501 Pin tools.
+ *
+ *  With a trigger set, a tool starts without its analysis instrumentation: the
+ *  only thing inserted is an inlined If-call per main-image basic block (instruction
+ *  budget / pipe request) and one at the trigger offset. When a trigger fires the
+ *  Then-call flips the mode flag and calls PIN_RemoveInstrumentation, so every
+ *  trace is re-JITted with the tool's full instrumentation (tools check FF_Active()
+ *  in their instrumentation callbacks). -ff_window bounds the analysed window, after
+ *  which the tool goes back to fast-forward. Every switch is logged with the
+ *  instruction count, and Fini lists the windows. With -ff_offset alone there is
+ *  no budget or pipe to check, so no per-block call is inserted and nothing is counted.
+ *
+ *  Triggers:
+ *    -ff_offset 0x1c5d -ff_hits 3   third execution of image offset 0x1c5d
+ *    -ff_icount N                   after N main-image instructions
+ *    -ff_pipe ff.cmd                echo go > ff.cmd  /  echo stop > ff.cmd
+ */
+
+#ifndef CS6501_FASTFORWARD_H
+#define CS6501_FASTFORWARD_H
+
+#include "pin.H"
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobFFOffset(KNOB_MODE_WRITEONCE, "pintool", "ff_offset", "",
+    "fast-forward until this main-image offset has executed -ff_hits times");
+KNOB<UINT64> KnobFFHits(KNOB_MODE_WRITEONCE, "pintool", "ff_hits", "1",
+    "executions of -ff_offset that start the analysis");
+KNOB<UINT64> KnobFFIcount(KNOB_MODE_WRITEONCE, "pintool", "ff_icount", "0",
+    "fast-forward over this many main-image instructions (0: no instruction trigger)");
+KNOB<std::string> KnobFFPipe(KNOB_MODE_WRITEONCE, "pintool", "ff_pipe", "",
+    "named pipe taking 'go' / 'stop' to switch the analysis on and off");
+KNOB<UINT64> KnobFFWindow(KNOB_MODE_WRITEONCE, "pintool", "ff_window", "0",
+    "main-image instructions to analyse before going back to fast-forward (0: until exit)");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define FF_BUDGET_NONE 0x7fffffffffffffffLL
+
+enum FF_CAUSE { FF_CAUSE_BUDGET, FF_CAUSE_OFFSET };
+enum FF_REQUEST { FF_REQ_NONE, FF_REQ_GO, FF_REQ_STOP };
+
+struct FF_WINDOW {
+    UINT64 start, end;      // main-image instruction counts
+    double startSec, endSec;
+    std::string on, off;    // what switched the analysis on / off
+};
+
+static BOOL g_ffEnabled = FALSE;        // any trigger given
+static volatile BOOL g_ffOn = TRUE;     // analysis instrumentation active
+static ADDRINT g_ffOffset = 0;
+static BOOL g_ffHasOffset = FALSE;
+static UINT64 g_ffHitsLeft = 0;
+static UINT64 g_ffIcount = 0;           // main-image instructions so far
+static INT64 g_ffBudget = FF_BUDGET_NONE;   // instructions until the budget trigger
+static volatile UINT32 g_ffRequest = FF_REQ_NONE;
+static ADDRINT g_ffLow = 0, g_ffHigh = 0;
+static PIN_LOCK g_ffLock;
+static std::vector<FF_WINDOW> g_ffWindows;
+static FILE* g_ffLog = 0;
+static struct timespec g_ffT0;
+static volatile BOOL g_ffStop = FALSE;
+static PIN_THREAD_UID g_ffPipeUid;
+
+/* ===================================================================== */
+
+static double FF_Seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - g_ffT0.tv_sec) + (t.tv_nsec - g_ffT0.tv_nsec) / 1e9;
+}
+
+// If-routines (inlined)
+static ADDRINT PIN_FAST_ANALYSIS_CALL FF_Tick(UINT32 numIns)
+{
+    g_ffIcount += numIns;
+    g_ffBudget -= numIns;
+    return (g_ffBudget <= 0) | g_ffRequest;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL FF_Hit()
+{
+    return --g_ffHitsLeft == 0;
+}
+
+static VOID FF_Switch(THREADID tid, UINT32 cause)
+{
+    PIN_GetLock(&g_ffLock, tid + 1);
+    BOOL on;
+    char why[64];
+    if (cause == FF_CAUSE_OFFSET) {
+        on = TRUE;
+        snprintf(why, sizeof(why), "offset %lx x%llu", g_ffOffset, (unsigned long long)KnobFFHits.Value());
+    }
+    else if (g_ffRequest != FF_REQ_NONE) {
+        on = g_ffRequest == FF_REQ_GO;
+        snprintf(why, sizeof(why), "pipe");
+        g_ffRequest = FF_REQ_NONE;
+    }
+    else {
+        on = !g_ffOn;   // budget ran out: -ff_icount reached, or the end of -ff_window
+        snprintf(why, sizeof(why), on ? "icount %llu" : "window %llu",
+            (unsigned long long)(on ? KnobFFIcount.Value() : KnobFFWindow.Value()));
+    }
+
+    if (on != g_ffOn) {
+        g_ffBudget = (on && KnobFFWindow.Value()) ? (INT64)KnobFFWindow.Value() : FF_BUDGET_NONE;
+        double now = FF_Seconds();
+        if (on) {
+            FF_WINDOW w = { g_ffIcount, 0, now, 0, why, "" };
+            g_ffWindows.push_back(w);
+        }
+        else {
+            g_ffWindows.back().end = g_ffIcount;
+            g_ffWindows.back().endSec = now;
+            g_ffWindows.back().off = why;
+        }
+        fprintf(g_ffLog, "[FF] analysis %s at icount %llu (%.1f s): %s\n", on ? "on" : "off",
+            (unsigned long long)g_ffIcount, now, why);
+        fflush(g_ffLog);
+
+        g_ffOn = on;
+        PIN_RemoveInstrumentation();    // re-JIT with / without the tool's analysis calls
+    }
+    PIN_ReleaseLock(&g_ffLock);
+}
+
+static VOID FF_ImageLoad(IMG img, VOID* v)
+{
+    if (IMG_IsMainExecutable(img)) {
+        g_ffLow = IMG_LowAddress(img);
+        g_ffHigh = IMG_HighAddress(img);
+    }
+}
+
+static VOID FF_Trace(TRACE trace, VOID* v)
+{
+    ADDRINT addr = TRACE_Address(trace);
+    if (addr < g_ffLow || addr >= g_ffHigh) return;
+
+    // FF_Switch re-JITs on every switch, so a window's budget gets its ticks then
+    BOOL tick = g_ffBudget != FF_BUDGET_NONE || !KnobFFPipe.Value().empty();
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        if (tick) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)FF_Tick, IARG_FAST_ANALYSIS_CALL,
+                IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)FF_Switch,
+                IARG_THREAD_ID, IARG_UINT32, FF_CAUSE_BUDGET, IARG_END);
+        }
+
+        if (g_ffOn || !g_ffHasOffset || g_ffHitsLeft == 0) continue;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            if (INS_Address(ins) - g_ffLow != g_ffOffset) continue;
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FF_Hit, IARG_FAST_ANALYSIS_CALL, IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)FF_Switch,
+                IARG_THREAD_ID, IARG_UINT32, FF_CAUSE_OFFSET, IARG_END);
+        }
+    }
+}
+
+static VOID FF_PipeThread(VOID* v)
+{
+    int fd = open(KnobFFPipe.Value().c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0) return;
+
+    std::string pending;
+    char buf[64];
+    while (!g_ffStop && !PIN_IsProcessExiting()) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            PIN_Sleep(20);
+            continue;
+        }
+        pending.append(buf, n);
+
+        size_t eol;
+        while ((eol = pending.find('\n')) != std::string::npos) {
+            std::string cmd = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            // Picked up by FF_Tick at the next main-image basic block
+            if (cmd == "go") g_ffRequest = FF_REQ_GO;
+            else if (cmd == "stop") g_ffRequest = FF_REQ_STOP;
+        }
+    }
+    close(fd);
+}
+
+static VOID FF_PrepareForFini(VOID* v)
+{
+    g_ffStop = TRUE;
+    PIN_WaitForThreadTermination(g_ffPipeUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init. Switches are logged to fp. FALSE on a bad knob.
+BOOL FF_Init(FILE* fp)
+{
+    g_ffLog = fp;
+    g_ffHasOffset = !KnobFFOffset.Value().empty();
+    g_ffEnabled = g_ffHasOffset || KnobFFIcount.Value() || !KnobFFPipe.Value().empty();
+    if (!g_ffEnabled) return TRUE;
+
+    if (g_ffHasOffset) {
+        char* end;
+        g_ffOffset = strtoul(KnobFFOffset.Value().c_str(), &end, 16);
+        if (*end != '\0' || KnobFFHits.Value() == 0) {
+            fprintf(stderr, "[FF] bad -ff_offset / -ff_hits\n");
+            return FALSE;
+        }
+        g_ffHitsLeft = KnobFFHits.Value();
+    }
+    if (!KnobFFPipe.Value().empty()) {
+        // Only a FIFO left behind by an earlier run is replaced
+        struct stat st;
+        if (lstat(KnobFFPipe.Value().c_str(), &st) == 0) {
+            if (!S_ISFIFO(st.st_mode)) {
+                fprintf(stderr, "[FF] %s exists and is not a FIFO\n", KnobFFPipe.Value().c_str());
+                return FALSE;
+            }
+            unlink(KnobFFPipe.Value().c_str());
+        }
+        if (mkfifo(KnobFFPipe.Value().c_str(), 0600) != 0) {
+            fprintf(stderr, "[FF] cannot create %s\n", KnobFFPipe.Value().c_str());
+            return FALSE;
+        }
+        PIN_SpawnInternalThread(FF_PipeThread, 0, 0, &g_ffPipeUid);
+        PIN_AddPrepareForFiniFunction(FF_PrepareForFini, 0);
+    }
+
+    g_ffOn = FALSE;
+    g_ffBudget = KnobFFIcount.Value() ? (INT64)KnobFFIcount.Value() : FF_BUDGET_NONE;
+    clock_gettime(CLOCK_MONOTONIC, &g_ffT0);
+    PIN_InitLock(&g_ffLock);
+    IMG_AddInstrumentFunction(FF_ImageLoad, 0);
+    TRACE_AddInstrumentFunction(FF_Trace, 0);
+    return TRUE;
+}
+
+// Instrumentation callbacks insert analysis calls only while this is TRUE.
+inline BOOL FF_Active() { return g_ffOn; }
+
+// Call from Fini: the analysed windows and how much was skipped.
+VOID FF_Report()
+{
+    if (!g_ffEnabled) return;
+
+    if (g_ffOn && !g_ffWindows.empty()) {
+        g_ffWindows.back().end = g_ffIcount;
+        g_ffWindows.back().endSec = FF_Seconds();
+        g_ffWindows.back().off = "exit";
+    }
+    UINT64 analysed = 0;
+    for (size_t i = 0; i < g_ffWindows.size(); i++) {
+        const FF_WINDOW& w = g_ffWindows[i];
+        analysed += w.end - w.start;
+        fprintf(g_ffLog, "[FF] window %lu: icount %llu - %llu (%.1f - %.1f s), on: %s, off: %s\n", (unsigned long)i + 1,
+            (unsigned long long)w.start, (unsigned long long)w.end, w.startSec, w.endSec, w.on.c_str(), w.off.c_str());
+    }
+    if (g_ffBudget == FF_BUDGET_NONE && g_ffIcount == 0 && KnobFFPipe.Value().empty()) {
+        fprintf(g_ffLog, "[FF] main-image instructions not counted with -ff_offset alone\n");
+        return;
+    }
+    fprintf(g_ffLog, "[FF] analysed %llu of %llu main-image instructions\n",
+        (unsigned long long)analysed, (unsigned long long)g_ffIcount);
+}
+
+#endif // CS6501_FASTFORWARD_H
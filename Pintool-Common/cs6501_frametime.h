@@ -0,0 +1,121 @@
+/*! @file
+ *  Frame-time measurement for the cs6501 game tools, in JIT and in probe mode.
+ *
+ *  A "frame" is one call of the routine that drives the game tick (scroll_handler
+ *  for moon-buggy). The time between two calls is what the player sees; every run
+ *  appends one CSV row to frametime.txt so JIT and probe runs can be compared
+ *  side by side.
+ */
+
+#ifndef CS6501_FRAMETIME_H
+#define CS6501_FRAMETIME_H
+
+#include "pin.H"
+#include <time.h>
+#include <math.h>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobFrameRtn(KNOB_MODE_WRITEONCE, "pintool", "frame_rtn", "scroll_handler",
+    "routine called once per frame, empty to disable frame timing");
+KNOB<std::string> KnobFrameFile(KNOB_MODE_WRITEONCE, "pintool", "frame_file", "frametime.txt",
+    "CSV file the frame-time summary is appended to");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define FRAMETIME_BIN_US    100     // histogram resolution
+#define FRAMETIME_NUM_BINS  5000    // up to 500 ms, longer frames land in the last bin
+
+static UINT64 g_frameHist[FRAMETIME_NUM_BINS];
+static UINT64 g_frameCount = 0;
+static UINT64 g_frameLastNs = 0;
+static double g_frameSumUs = 0;
+static double g_frameSumSqUs = 0;
+static double g_frameMaxUs = 0;
+
+/* ===================================================================== */
+
+static UINT64 FrameTime_NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Called at the entry of the frame routine (natively in probe mode).
+static VOID FrameTime_Tick()
+{
+    UINT64 now = FrameTime_NowNs();
+    if (g_frameLastNs) {
+        double us = (now - g_frameLastNs) / 1000.0;
+        UINT64 bin = (UINT64)(us / FRAMETIME_BIN_US);
+        g_frameHist[bin < FRAMETIME_NUM_BINS ? bin : FRAMETIME_NUM_BINS - 1]++;
+        g_frameCount++;
+        g_frameSumUs += us;
+        g_frameSumSqUs += us * us;
+        if (us > g_frameMaxUs) g_frameMaxUs = us;
+    }
+    g_frameLastNs = now;
+}
+
+static double FrameTime_PercentileMs(double p)
+{
+    UINT64 rank = (UINT64)ceil(p * g_frameCount);
+    UINT64 seen = 0;
+    for (UINT32 i = 0; i < FRAMETIME_NUM_BINS; i++) {
+        seen += g_frameHist[i];
+        if (seen >= rank) return (i + 1) * FRAMETIME_BIN_US / 1000.0;
+    }
+    return g_frameMaxUs / 1000.0;
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from ImageLoad() for the main executable. Needs PIN_InitSymbols().
+VOID FrameTime_Instrument(IMG img, BOOL probed)
+{
+    if (KnobFrameRtn.Value().empty()) return;
+
+    RTN rtn = RTN_FindByName(img, KnobFrameRtn.Value().c_str());
+    if (!RTN_Valid(rtn)) {
+        fprintf(stderr, "[FRAME] %s not found, no frame timing\n", KnobFrameRtn.Value().c_str());
+        return;
+    }
+    if (probed) {
+        RTN_InsertCallProbed(rtn, IPOINT_BEFORE, (AFUNPTR)FrameTime_Tick, IARG_END);
+    }
+    else {
+        RTN_Open(rtn);
+        RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)FrameTime_Tick, IARG_END);
+        RTN_Close(rtn);
+    }
+}
+
+// Call from Fini. mode names the run in the CSV ("jit", "probe", ...).
+VOID FrameTime_Report(const char* mode)
+{
+    if (KnobFrameRtn.Value().empty() || g_frameCount == 0) return;
+
+    FILE* fp = fopen(KnobFrameFile.Value().c_str(), "at");
+    if (fp == 0) return;
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0) {
+        fprintf(fp, "mode,frames,mean_ms,stddev_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    }
+
+    double mean = g_frameSumUs / g_frameCount;
+    double var = g_frameSumSqUs / g_frameCount - mean * mean;
+    fprintf(fp, "%s,%llu,%.2f,%.2f,%.1f,%.1f,%.1f,%.2f\n", mode, (unsigned long long)g_frameCount,
+        mean / 1000.0, sqrt(var > 0 ? var : 0) / 1000.0,
+        FrameTime_PercentileMs(0.50), FrameTime_PercentileMs(0.95), FrameTime_PercentileMs(0.99),
+        g_frameMaxUs / 1000.0);
+    fclose(fp);
+}
+
+#endif // CS6501_FRAMETIME_H
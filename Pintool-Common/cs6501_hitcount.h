@@ -0,0 +1,92 @@
+/*! @file
+ *  Per-thread write hit-count tables for the cs6501 Pin tools.
+ *
+ *  Replaces the global `unsigned short g_accessMap[0xFFFF]`: each thread gets its
+ *  own 64-bit table sized from the main image (IMG_HighAddress - IMG_LowAddress),
+ *  kept in Pin TLS so the analysis routines never share a counter. Fini merges them.
+ */
+
+#ifndef CS6501_HITCOUNT_H
+#define CS6501_HITCOUNT_H
+
+#include "pin.H"
+#include <vector>
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+static TLS_KEY g_hitKey = INVALID_TLS_KEY;
+static PIN_LOCK g_hitLock;                  // guards g_hitTables
+static std::vector<UINT64*> g_hitTables;    // every table ever handed out, merged at Fini
+static ADDRINT g_hitSize = 0;               // entries per table, 0 until the main image is loaded
+static UINT64* g_hitMerged = 0;
+
+/* ===================================================================== */
+
+static UINT64* HitCount_Alloc(THREADID tid)
+{
+    UINT64* table = new UINT64[g_hitSize]();
+    PIN_SetThreadData(g_hitKey, table, tid);
+
+    PIN_GetLock(&g_hitLock, tid + 1);
+    g_hitTables.push_back(table);
+    PIN_ReleaseLock(&g_hitLock);
+    return table;
+}
+
+static VOID HitCount_ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    // The main thread may start before the main image is reported; it allocates lazily.
+    if (g_hitSize) HitCount_Alloc(tid);
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init.
+VOID HitCount_Init()
+{
+    PIN_InitLock(&g_hitLock);
+    g_hitKey = PIN_CreateThreadDataKey(0);
+    PIN_AddThreadStartFunction(HitCount_ThreadStart, 0);
+}
+
+// Call from ImageLoad() for the main executable.
+VOID HitCount_SetImage(ADDRINT low, ADDRINT high)
+{
+    g_hitSize = high - low + 1;
+}
+
+inline ADDRINT HitCount_Size() { return g_hitSize; }
+
+// offset must be below HitCount_Size(), i.e. ip inside [g_addrLow, g_addrHigh].
+inline UINT64 HitCount_Inc(THREADID tid, ADDRINT offset)
+{
+    UINT64* table = static_cast<UINT64*>(PIN_GetThreadData(g_hitKey, tid));
+    if (table == 0) table = HitCount_Alloc(tid);
+    return ++table[offset];
+}
+
+inline UINT64 HitCount_Get(THREADID tid, ADDRINT offset)
+{
+    UINT64* table = static_cast<UINT64*>(PIN_GetThreadData(g_hitKey, tid));
+    return table ? table[offset] : 0;
+}
+
+// Sum of all thread tables, HitCount_Size() entries. Call from Fini.
+const UINT64* HitCount_Merge()
+{
+    if (g_hitMerged == 0) {
+        g_hitMerged = new UINT64[g_hitSize]();
+        for (size_t t = 0; t < g_hitTables.size(); t++) {
+            for (ADDRINT i = 0; i < g_hitSize; i++) {
+                g_hitMerged[i] += g_hitTables[t][i];
+            }
+        }
+    }
+    return g_hitMerged;
+}
+
+#endif // CS6501_HITCOUNT_H
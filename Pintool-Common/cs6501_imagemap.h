@@ -0,0 +1,148 @@
+/*! @file
+ *  Map of every loaded image, and opt-in instrumentation of library images.
+ *
+ *  Each mapped region of each image is one interval. Images never overlap, so the
+ *  interval tree degenerates to a sorted array searched with upper_bound: O(log n)
+ *  address -> (image, offset) from analysis routines. Loads and unloads publish a
+ *  new sorted copy with one atomic store, so lookups take no lock (old copies are
+ *  kept; images are loaded a handful of times per run).
+ *
+ *  -libs takes glob patterns of library file names (libncurses*,libtinfo*); the
+ *  tools instrument the main executable plus the images that match, so ncurses
+ *  rendering can be profiled without paying for all of libc.
+ */
+
+#ifndef CS6501_IMAGEMAP_H
+#define CS6501_IMAGEMAP_H
+
+#include "pin.H"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fnmatch.h>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobLibs(KNOB_MODE_WRITEONCE, "pintool", "libs", "",
+    "comma-separated glob patterns of library images to instrument too, e.g. libncurses*,libtinfo* ('*': all)");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+struct IMAGE_INFO {
+    UINT32 id;              // IMG_Id
+    std::string name;       // full path
+    std::string shortName;  // file name only
+    ADDRINT low, high;      // IMG_LowAddress / IMG_HighAddress, offsets are relative to low
+    BOOL main;
+    BOOL instrument;        // main executable or matched by -libs
+};
+
+struct IMAGE_RANGE {
+    ADDRINT low, high;      // inclusive
+    const IMAGE_INFO* img;
+};
+
+inline bool operator<(ADDRINT addr, const IMAGE_RANGE& r) { return addr < r.low; }
+inline bool operator<(const IMAGE_RANGE& a, const IMAGE_RANGE& b) { return a.low < b.low; }
+
+static std::vector<IMAGE_RANGE>* g_imgRanges = 0;    // current snapshot, sorted by low
+static std::vector<std::string> g_imgPatterns;
+
+/* ===================================================================== */
+
+static std::string ImageMap_ShortName(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static BOOL ImageMap_Matches(const std::string& shortName)
+{
+    for (size_t i = 0; i < g_imgPatterns.size(); i++) {
+        if (fnmatch(g_imgPatterns[i].c_str(), shortName.c_str(), 0) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+static VOID ImageMap_Publish(std::vector<IMAGE_RANGE>* ranges)
+{
+    std::sort(ranges->begin(), ranges->end());
+    __atomic_store_n(&g_imgRanges, ranges, __ATOMIC_RELEASE);
+}
+
+static VOID ImageMap_Load(IMG img, VOID* v)
+{
+    IMAGE_INFO* info = new IMAGE_INFO();
+    info->id = IMG_Id(img);
+    info->name = IMG_Name(img);
+    info->shortName = ImageMap_ShortName(info->name);
+    info->low = IMG_LowAddress(img);
+    info->high = IMG_HighAddress(img);
+    info->main = IMG_IsMainExecutable(img);
+    info->instrument = info->main || ImageMap_Matches(info->shortName);
+
+    std::vector<IMAGE_RANGE>* ranges = new std::vector<IMAGE_RANGE>(*g_imgRanges);
+    for (UINT32 r = 0; r < IMG_NumRegions(img); r++) {
+        IMAGE_RANGE range = { IMG_RegionLowAddress(img, r), IMG_RegionHighAddress(img, r), info };
+        ranges->push_back(range);
+    }
+    ImageMap_Publish(ranges);
+}
+
+static VOID ImageMap_Unload(IMG img, VOID* v)
+{
+    std::vector<IMAGE_RANGE>* ranges = new std::vector<IMAGE_RANGE>();
+    for (size_t i = 0; i < g_imgRanges->size(); i++) {
+        if ((*g_imgRanges)[i].img->id != IMG_Id(img)) ranges->push_back((*g_imgRanges)[i]);
+    }
+    ImageMap_Publish(ranges);
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init, before the tool adds its own image callback.
+VOID ImageMap_Init()
+{
+    const std::string& libs = KnobLibs.Value();
+    for (size_t start = 0; start < libs.size(); ) {
+        size_t comma = libs.find(',', start);
+        if (comma == std::string::npos) comma = libs.size();
+        if (comma > start) g_imgPatterns.push_back(libs.substr(start, comma - start));
+        start = comma + 1;
+    }
+
+    g_imgRanges = new std::vector<IMAGE_RANGE>();
+    IMG_AddInstrumentFunction(ImageMap_Load, 0);
+    IMG_AddUnloadFunction(ImageMap_Unload, 0);
+}
+
+// Image containing addr (offset = addr - image low address), or 0. Safe in analysis routines.
+inline const IMAGE_INFO* ImageMap_Find(ADDRINT addr, ADDRINT* offset = 0)
+{
+    const std::vector<IMAGE_RANGE>* ranges = __atomic_load_n(&g_imgRanges, __ATOMIC_ACQUIRE);
+    std::vector<IMAGE_RANGE>::const_iterator it = std::upper_bound(ranges->begin(), ranges->end(), addr);
+    if (it == ranges->begin() || addr > (--it)->high) return 0;
+    if (offset) *offset = addr - it->img->low;
+    return it->img;
+}
+
+// Main executable, or a library matched by -libs.
+inline BOOL ImageMap_Instrumented(ADDRINT addr)
+{
+    const IMAGE_INFO* img = ImageMap_Find(addr);
+    return img && img->instrument;
+}
+
+// Same test for an IMG at instrumentation time (e.g. RTN callbacks, before the map has it).
+inline BOOL ImageMap_WantImage(IMG img)
+{
+    return IMG_Valid(img) && (IMG_IsMainExecutable(img) || ImageMap_Matches(ImageMap_ShortName(IMG_Name(img))));
+}
+
+#endif // CS6501_IMAGEMAP_H
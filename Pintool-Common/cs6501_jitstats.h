@@ -0,0 +1,266 @@
+/*! @file
+ *  JIT / code-cache statistics for the cs6501 Pin tools.
+ *
+ *  Tells where a slow run goes: into the tool's instrumentation routines (the
+ *  INS_Disassemble-heavy Instruction() callbacks), into Pin compiling traces, or
+ *  into the code cache (analysis routines and the program itself). Tools register
+ *  their INS / TRACE callbacks through JitStats_AddInsFunction / _AddTraceFunction,
+ *  which time every call with rdtsc. A trace's JIT time runs from the first
+ *  instrumentation callback Pin makes for it to CODECACHE_AddTraceInsertedFunction,
+ *  so JitStats_Init must come before any other instrumentation is registered.
+ *  Every inserted trace is counted per original address: an address compiled more
+ *  than once was re-JITted (cache flush, invalidation, PIN_RemoveInstrumentation
+ *  from fast-forward, or a second entry version).
+ */
+
+#ifndef CS6501_JITSTATS_H
+#define CS6501_JITSTATS_H
+
+#include "pin.H"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<BOOL> KnobJitStats(KNOB_MODE_WRITEONCE, "pintool", "jit_stats", "1",
+    "time instrumentation and count code-cache traces, reported at Fini");
+KNOB<UINT32> KnobJitTop(KNOB_MODE_WRITEONCE, "pintool", "jit_top", "10",
+    "re-JITted traces listed at Fini");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+struct JIT_CALLBACK {
+    const char* name;
+    INS_INSTRUMENT_CALLBACK insFun;
+    TRACE_INSTRUMENT_CALLBACK traceFun;
+    UINT64 calls, ticks;
+};
+
+struct JIT_TRACE {
+    UINT32 compiles, numIns;
+    UINT64 bytes, ticks;
+};
+
+// All of these are touched by instrumentation and code-cache callbacks only,
+// which Pin serializes under its VM lock
+static BOOL g_jitOn = FALSE;
+static std::vector<JIT_CALLBACK*> g_jitCallbacks;
+static std::unordered_map<ADDRINT, JIT_TRACE> g_jitTraces;
+static UINT64 g_jitStart = 0;           // first callback of the trace being compiled, 0: none
+static UINT64 g_jitTicks = 0;           // instrumentation + compile, over all traces
+static UINT64 g_jitInserted = 0, g_jitInsertedIns = 0, g_jitInsertedBytes = 0;
+static UINT64 g_jitFlushes = 0, g_jitFull = 0, g_jitInvalidated = 0;
+static UINT64 g_jitT0Ticks = 0, g_jitT0Ns = 0;
+
+/* ===================================================================== */
+
+static inline UINT64 JitStats_Ticks()
+{
+    UINT32 lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((UINT64)hi << 32) | lo;
+}
+
+static UINT64 JitStats_NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline VOID JitStats_Begin(UINT64 now)
+{
+    if (g_jitStart == 0) g_jitStart = now;
+}
+
+static VOID JitStats_Ins(INS ins, VOID* v)
+{
+    JIT_CALLBACK* cb = (JIT_CALLBACK*)v;
+    UINT64 t0 = JitStats_Ticks();
+    JitStats_Begin(t0);
+    cb->insFun(ins, 0);
+    cb->ticks += JitStats_Ticks() - t0;
+    cb->calls++;
+}
+
+static VOID JitStats_Trace(TRACE trace, VOID* v)
+{
+    JIT_CALLBACK* cb = (JIT_CALLBACK*)v;
+    UINT64 t0 = JitStats_Ticks();
+    JitStats_Begin(t0);
+    cb->traceFun(trace, 0);
+    cb->ticks += JitStats_Ticks() - t0;
+    cb->calls++;
+}
+
+// Registered first: marks the start of the trace's JIT
+static VOID JitStats_TraceStart(TRACE trace, VOID* v)
+{
+    JitStats_Begin(JitStats_Ticks());
+}
+
+static VOID JitStats_TraceInserted(TRACE trace, VOID* v)
+{
+    UINT64 ticks = g_jitStart ? JitStats_Ticks() - g_jitStart : 0;
+    g_jitStart = 0;
+    g_jitTicks += ticks;
+
+    JIT_TRACE& t = g_jitTraces[TRACE_Address(trace)];
+    t.compiles++;
+    t.numIns = TRACE_NumIns(trace);
+    t.bytes += TRACE_CodeCacheSize(trace);
+    t.ticks += ticks;
+    g_jitInserted++;
+    g_jitInsertedIns += t.numIns;
+    g_jitInsertedBytes += TRACE_CodeCacheSize(trace);
+}
+
+static VOID JitStats_TraceInvalidated(ADDRINT origPc, ADDRINT cachePc, BOOL success)
+{
+    if (success) g_jitInvalidated++;
+}
+
+static VOID JitStats_CacheFlushed() { g_jitFlushes++; }
+
+static VOID JitStats_CacheFull(USIZE traceSize, USIZE stubSize) { g_jitFull++; }
+
+static JIT_CALLBACK* JitStats_NewCallback(const char* name)
+{
+    JIT_CALLBACK* cb = new JIT_CALLBACK();
+    cb->name = name;
+    g_jitCallbacks.push_back(cb);
+    return cb;
+}
+
+static double JitStats_Seconds(UINT64 ticks, double nsPerTick)
+{
+    return ticks * nsPerTick / 1e9;
+}
+
+// "flappybird+0x1c5d controlCollision(int, int, int, int, int)" for a trace address
+static std::string JitStats_Where(ADDRINT addr)
+{
+    char buf[64];
+    std::string where;
+    PIN_LockClient();
+    IMG img = IMG_FindByAddress(addr);
+    if (IMG_Valid(img)) {
+        std::string name = IMG_Name(img);
+        size_t slash = name.rfind('/');
+        snprintf(buf, sizeof(buf), "+0x%lx", (unsigned long)(addr - IMG_LowAddress(img)));
+        where = name.substr(slash == std::string::npos ? 0 : slash + 1) + buf;
+    }
+    else {
+        snprintf(buf, sizeof(buf), "0x%lx", (unsigned long)addr);
+        where = buf;
+    }
+    std::string rtn = RTN_FindNameByAddress(addr);
+    PIN_UnlockClient();
+    return rtn.empty() ? where : where + " " + PIN_UndecorateSymbolName(rtn, UNDECORATION_NAME_ONLY);
+}
+
+static bool JitStats_ByCompiles(const std::pair<ADDRINT, JIT_TRACE>& a, const std::pair<ADDRINT, JIT_TRACE>& b)
+{
+    if (a.second.compiles != b.second.compiles) return a.second.compiles > b.second.compiles;
+    return a.second.ticks > b.second.ticks;
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() right after PIN_Init, before anything registers instrumentation.
+VOID JitStats_Init()
+{
+    g_jitOn = KnobJitStats.Value();
+    if (!g_jitOn) return;
+
+    g_jitT0Ns = JitStats_NowNs();
+    g_jitT0Ticks = JitStats_Ticks();
+    TRACE_AddInstrumentFunction(JitStats_TraceStart, 0);
+    CODECACHE_AddTraceInsertedFunction(JitStats_TraceInserted, 0);
+    CODECACHE_AddTraceInvalidatedFunction(JitStats_TraceInvalidated, 0);
+    CODECACHE_AddCacheFlushedFunction(JitStats_CacheFlushed, 0);
+    CODECACHE_AddFullCacheFunction(JitStats_CacheFull, 0);
+}
+
+// INS_AddInstrumentFunction(fun, 0), timed under name.
+VOID JitStats_AddInsFunction(INS_INSTRUMENT_CALLBACK fun, const char* name)
+{
+    if (!g_jitOn) {
+        INS_AddInstrumentFunction(fun, 0);
+        return;
+    }
+    JIT_CALLBACK* cb = JitStats_NewCallback(name);
+    cb->insFun = fun;
+    INS_AddInstrumentFunction(JitStats_Ins, cb);
+}
+
+// TRACE_AddInstrumentFunction(fun, 0), timed under name.
+VOID JitStats_AddTraceFunction(TRACE_INSTRUMENT_CALLBACK fun, const char* name)
+{
+    if (!g_jitOn) {
+        TRACE_AddInstrumentFunction(fun, 0);
+        return;
+    }
+    JIT_CALLBACK* cb = JitStats_NewCallback(name);
+    cb->traceFun = fun;
+    TRACE_AddInstrumentFunction(JitStats_Trace, cb);
+}
+
+// Call from Fini: JIT vs code-cache time, cache usage and the most re-JITted traces.
+VOID JitStats_Report(FILE* fp)
+{
+    if (!g_jitOn) return;
+
+    UINT64 wallNs = JitStats_NowNs() - g_jitT0Ns;
+    UINT64 wallTicks = JitStats_Ticks() - g_jitT0Ticks;
+    double nsPerTick = wallTicks ? (double)wallNs / wallTicks : 0;
+    double wall = wallNs / 1e9, jit = JitStats_Seconds(g_jitTicks, nsPerTick);
+
+    fprintf(fp, "[JIT] wall %.2f s: jit %.3f s (%.1f%%), code cache (analysis + program) %.2f s\n",
+        wall, jit, wall > 0 ? 100.0 * jit / wall : 0.0, wall - jit);
+
+    UINT64 toolTicks = 0;
+    for (size_t i = 0; i < g_jitCallbacks.size(); i++) {
+        const JIT_CALLBACK* cb = g_jitCallbacks[i];
+        double sec = JitStats_Seconds(cb->ticks, nsPerTick);
+        fprintf(fp, "[JIT] instrumentation %s: %.3f s, %llu calls, %.2f us/call\n", cb->name, sec,
+            (unsigned long long)cb->calls, cb->calls ? sec * 1e6 / cb->calls : 0.0);
+        toolTicks += cb->ticks;
+    }
+    fprintf(fp, "[JIT] Pin compile and other callbacks: %.3f s\n",
+        JitStats_Seconds(g_jitTicks > toolTicks ? g_jitTicks - toolTicks : 0, nsPerTick));
+
+    fprintf(fp, "[JIT] traces compiled %llu (%lu addresses, %llu instructions), %.1f KB generated\n",
+        (unsigned long long)g_jitInserted, (unsigned long)g_jitTraces.size(),
+        (unsigned long long)g_jitInsertedIns, g_jitInsertedBytes / 1024.0);
+    fprintf(fp, "[JIT] code cache %.1f KB used of %.1f KB, %u traces; %llu flushes, %llu full, %llu traces invalidated\n",
+        CODECACHE_CodeMemUsed() / 1024.0, CODECACHE_CacheSizeLimit() / 1024.0, CODECACHE_NumTracesInCache(),
+        (unsigned long long)g_jitFlushes, (unsigned long long)g_jitFull, (unsigned long long)g_jitInvalidated);
+
+    std::vector<std::pair<ADDRINT, JIT_TRACE> > rejit;
+    for (std::unordered_map<ADDRINT, JIT_TRACE>::const_iterator it = g_jitTraces.begin(); it != g_jitTraces.end(); ++it) {
+        if (it->second.compiles > 1) rejit.push_back(*it);
+    }
+    size_t n = std::min((size_t)KnobJitTop.Value(), rejit.size());
+    std::partial_sort(rejit.begin(), rejit.begin() + n, rejit.end(), JitStats_ByCompiles);
+    fprintf(fp, "[JIT] %lu traces re-JITted, top %lu:\n", (unsigned long)rejit.size(), (unsigned long)n);
+    fprintf(fp, "[JIT] %8s %6s %10s %10s  %s\n", "compiles", "ins", "bytes", "jit us", "trace");
+    for (size_t i = 0; i < n; i++) {
+        const JIT_TRACE& t = rejit[i].second;
+        fprintf(fp, "[JIT] %8u %6u %10llu %10.1f  %s\n", t.compiles, t.numIns, (unsigned long long)t.bytes,
+            JitStats_Seconds(t.ticks, nsPerTick) * 1e6, JitStats_Where(rejit[i].first).c_str());
+    }
+}
+
+#endif // CS6501_JITSTATS_H
@@ -0,0 +1,226 @@
+/*! @file
+ *  Patch-spec files shared by the cs6501 cheat tools.
+ *
+ *  One patch per line, '#' starts a comment:
+ *
+ *      <location>  setreg <reg> <value>    set a register before the instruction
+ *      <location>  jump   <location>       jump from the instruction to another one
+ *      <location>  skip                    do not execute the instruction
+ *      <location>  nop    <count>          overwrite count bytes with NOPs
+ *      <location>  imm    <pos> <size> <value>
+ *                                          rewrite the size-byte immediate at byte pos
+ *                                          of the instruction (movl $0x1,... -> $0x0)
+ *
+ *  Any line may end with "expect <hex bytes>" (expect 89851cffffff): the original
+ *  bytes at the location, checked before the patch is applied, so a spec written
+ *  for one build of the game is not silently applied to another.
+ *
+ *  A location is an offset in the main image (0xa7be), a symbol (crash_check)
+ *  or a symbol plus an offset (crash_check+0x4), so a spec survives rebuilds
+ *  of the game as long as the routine bodies do not change.
+ *
+ *  Kept free of pin.H so the static patcher (cs6501_elfpatch.cpp) can include it:
+ *  the Pin tool applies a spec at run time, the patcher bakes jumps, NOP runs and
+ *  immediates into a copy of the binary.
+ */
+
+#ifndef CS6501_PATCHSPEC_H
+#define CS6501_PATCHSPEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+enum PATCH_ACTION {
+    PATCH_SETREG,
+    PATCH_JUMP,
+    PATCH_SKIP,
+    PATCH_NOP,
+    PATCH_IMM,
+};
+
+struct PATCH_LOC {
+    std::string symbol;     // empty: offset is relative to the image base
+    uint64_t offset;
+};
+
+struct PATCH_SPEC {
+    PATCH_LOC where;
+    PATCH_ACTION action;
+    std::string reg;        // PATCH_SETREG
+    uint64_t value;         // PATCH_SETREG, PATCH_IMM
+    PATCH_LOC target;       // PATCH_JUMP
+    uint64_t length;        // PATCH_NOP: bytes, PATCH_IMM: immediate size
+    uint64_t pos;           // PATCH_IMM: immediate position in the instruction
+    std::vector<uint8_t> expect;    // original bytes, empty: not checked
+    int line;               // for error messages
+};
+
+static bool PatchSpec_ParseNumber(const char* text, uint64_t* value)
+{
+    char* end;
+    if (*text == 0) return false;
+    *value = strtoull(text, &end, 0);
+    return *end == 0;
+}
+
+// "0xa7be", "crash_check" or "crash_check+0x4"
+static bool PatchSpec_ParseLoc(const char* text, PATCH_LOC* loc)
+{
+    loc->symbol.clear();
+    loc->offset = 0;
+    if (*text >= '0' && *text <= '9') {
+        return PatchSpec_ParseNumber(text, &loc->offset);
+    }
+    const char* plus = strchr(text, '+');
+    if (plus == 0) {
+        loc->symbol = text;
+        return true;
+    }
+    loc->symbol.assign(text, plus - text);
+    return !loc->symbol.empty() && PatchSpec_ParseNumber(plus + 1, &loc->offset);
+}
+
+// "89851cffffff" -> 89 85 1c ff ff ff
+static bool PatchSpec_ParseBytes(const char* text, std::vector<uint8_t>* bytes)
+{
+    size_t n = strlen(text);
+    if (n == 0 || n % 2) return false;
+    bytes->clear();
+    for (size_t i = 0; i < n; i += 2) {
+        char hex[3] = { text[i], text[i + 1], 0 };
+        char* end;
+        bytes->push_back((uint8_t)strtoul(hex, &end, 16));
+        if (*end) return false;
+    }
+    return true;
+}
+
+// Machine code of a JUMP, NOP or IMM patch at image offset 'offset' (JUMP: to
+// image offset 'target'). The bytes are written over the original ones starting
+// at the location. SETREG and SKIP have no byte form and return false.
+bool PatchSpec_Encode(const PATCH_SPEC& spec, uint64_t offset, uint64_t target, std::vector<uint8_t>& bytes)
+{
+    bytes.clear();
+    switch (spec.action) {
+    case PATCH_JUMP:
+        {
+            int64_t rel = (int64_t)(target - offset) - 2;
+            if (rel >= -128 && rel <= 127) {
+                bytes.push_back(0xeb);                  // jmp rel8
+                bytes.push_back((uint8_t)rel);
+            }
+            else {
+                int32_t rel32 = (int32_t)(rel - 3);     // jmp rel32
+                bytes.push_back(0xe9);
+                for (int i = 0; i < 4; i++) bytes.push_back((uint8_t)(rel32 >> (8 * i)));
+            }
+        }
+        return true;
+    case PATCH_NOP:
+        {
+            // Recommended multi-byte NOPs, so a run is as few instructions as possible
+            static const uint8_t nops[9][9] = {
+                { 0x90 },
+                { 0x66, 0x90 },
+                { 0x0f, 0x1f, 0x00 },
+                { 0x0f, 0x1f, 0x40, 0x00 },
+                { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+                { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+            };
+            for (uint64_t left = spec.length; left > 0; ) {
+                uint64_t n = left < 9 ? left : 9;
+                bytes.insert(bytes.end(), nops[n - 1], nops[n - 1] + n);
+                left -= n;
+            }
+        }
+        return true;
+    case PATCH_IMM:
+        bytes.resize(spec.pos + spec.length);
+        for (uint64_t i = 0; i < spec.length; i++) {
+            bytes[spec.pos + i] = (uint8_t)(spec.value >> (8 * i));
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Appends the patches of 'path' to 'specs'. Errors go to stderr with the line number.
+bool PatchSpec_Load(const char* path, std::vector<PATCH_SPEC>& specs)
+{
+    FILE* fp = fopen(path, "rt");
+    if (fp == 0) {
+        fprintf(stderr, "[PATCH] cannot open %s\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    char line[512];
+    for (int lineNo = 1; fgets(line, sizeof(line), fp); lineNo++) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = 0;
+
+        char* tok[8];
+        int n = 0;
+        for (char* t = strtok(line, " \t\r\n"); t && n < 8; t = strtok(0, " \t\r\n")) {
+            tok[n++] = t;
+        }
+        if (n == 0) continue;
+
+        PATCH_SPEC spec;
+        spec.value = 0;
+        spec.target.offset = 0;
+        spec.length = 0;
+        spec.pos = 0;
+        spec.line = lineNo;
+        bool good = true;
+        if (n >= 4 && strcmp(tok[n - 2], "expect") == 0) {
+            good = PatchSpec_ParseBytes(tok[n - 1], &spec.expect);
+            n -= 2;
+        }
+        good = good && n >= 2 && PatchSpec_ParseLoc(tok[0], &spec.where);
+        if (good && strcmp(tok[1], "setreg") == 0 && n == 4) {
+            spec.action = PATCH_SETREG;
+            spec.reg = tok[2];
+            good = PatchSpec_ParseNumber(tok[3], &spec.value);
+        }
+        else if (good && strcmp(tok[1], "jump") == 0 && n == 3) {
+            spec.action = PATCH_JUMP;
+            good = PatchSpec_ParseLoc(tok[2], &spec.target);
+        }
+        else if (good && strcmp(tok[1], "skip") == 0 && n == 2) {
+            spec.action = PATCH_SKIP;
+        }
+        else if (good && strcmp(tok[1], "nop") == 0 && n == 3) {
+            spec.action = PATCH_NOP;
+            good = PatchSpec_ParseNumber(tok[2], &spec.length) && spec.length > 0;
+        }
+        else if (good && strcmp(tok[1], "imm") == 0 && n == 5) {
+            spec.action = PATCH_IMM;
+            good = PatchSpec_ParseNumber(tok[2], &spec.pos) && PatchSpec_ParseNumber(tok[3], &spec.length) &&
+                   PatchSpec_ParseNumber(tok[4], &spec.value) &&
+                   (spec.length == 1 || spec.length == 2 || spec.length == 4 || spec.length == 8) && spec.pos < 15;
+        }
+        else {
+            good = false;
+        }
+
+        if (!good) {
+            fprintf(stderr, "[PATCH] %s:%d: cannot parse patch\n", path, lineNo);
+            ok = false;
+            continue;
+        }
+        specs.push_back(spec);
+    }
+    fclose(fp);
+    return ok;
+}
+
+#endif // CS6501_PATCHSPEC_H
@@ -0,0 +1,348 @@
+/*! @file
+ *  Deterministic record / replay of the games' nondeterministic inputs.
+ *
+ *  flappybird seeds with srand(time(NULL)) and polls getch(); moon-buggy paces
+ *  itself with select() + gettimeofday(). With -record <file>, time, gettimeofday,
+ *  rand, wgetch (getch is a macro for it), read and select are replaced with
+ *  RTN_ReplaceSignature; the original is called through PIN_CallApplicationFunction
+ *  and its return value plus output buffers are appended to the log. With
+ *  -replay <file>, the original is not called at all and the logged results are
+ *  handed back in order, so the same session can be profiled again and again
+ *  without a human at the keyboard (and without waiting on timeouts).
+ *
+ *  Calls made from inside a replaced function (ncurses' read() inside wgetch())
+ *  are not logged: replaying the outer call already covers them. If the program
+ *  asks for a different function than the log holds, replay stops and the rest of
+ *  the run is live; Fini reports where. errno is not restored.
+ *
+ *  JIT mode only (PIN_CallApplicationFunction).
+ */
+
+#ifndef CS6501_REPLAY_H
+#define CS6501_REPLAY_H
+
+#include "pin.H"
+#include <string>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobRecord(KNOB_MODE_WRITEONCE, "pintool", "record", "",
+    "record time/gettimeofday/rand/wgetch/read/select results to this file");
+KNOB<std::string> KnobReplay(KNOB_MODE_WRITEONCE, "pintool", "replay", "",
+    "feed the results recorded with -record back instead of calling the functions");
+KNOB<std::string> KnobReplayFuncs(KNOB_MODE_WRITEONCE, "pintool", "rr_funcs", "time,gettimeofday,rand,wgetch,read,select",
+    "functions to record / replay");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define RR_MAGIC "CS6501RR"
+#define RR_PAYLOAD_MAX (4 * sizeof(fd_set) + sizeof(struct timeval) + 1)
+
+enum RR_KIND { RR_NONE, RR_TIME, RR_GETTIMEOFDAY, RR_RAND, RR_WGETCH, RR_READ, RR_SELECT };
+static const char* g_rrNames[] = { "", "time", "gettimeofday", "rand", "wgetch", "read", "select" };
+
+// One per call, followed by len payload bytes (output buffers of the call).
+struct RR_EVENT {
+    UINT8 kind;
+    UINT8 reserved[3];
+    UINT32 len;
+    INT64 ret;
+};
+
+static FILE* g_rrFile = 0;
+static BOOL g_rrReplaying = FALSE;
+static BOOL g_rrLive = FALSE;               // replay ended (log exhausted or diverged)
+static PIN_LOCK g_rrLock;                   // guards g_rrFile and the counters
+static UINT64 g_rrEvents = 0;
+static RR_KIND g_rrExpected = RR_NONE, g_rrGot = RR_NONE;   // first divergence
+static UINT32 g_rrDepth[PIN_MAX_THREADS];   // nesting of replaced functions per thread
+
+/* ===================================================================== */
+
+static VOID RR_Put(THREADID tid, RR_KIND kind, INT64 ret, const VOID* data, UINT32 len)
+{
+    RR_EVENT ev = { (UINT8)kind, { 0, 0, 0 }, len, ret };
+    PIN_GetLock(&g_rrLock, tid + 1);
+    fwrite(&ev, sizeof(ev), 1, g_rrFile);
+    if (len) fwrite(data, 1, len, g_rrFile);
+    g_rrEvents++;
+    PIN_ReleaseLock(&g_rrLock);
+}
+
+// Next logged result for kind, payload copied to data (at most cap bytes).
+// FALSE once replay has ended: the caller then runs live.
+static BOOL RR_Get(THREADID tid, RR_KIND kind, INT64* ret, VOID* data, UINT32 cap, UINT32* len)
+{
+    BOOL ok = FALSE;
+    PIN_GetLock(&g_rrLock, tid + 1);
+    if (!g_rrLive) {
+        long pos = ftell(g_rrFile);
+        RR_EVENT ev;
+        if (fread(&ev, sizeof(ev), 1, g_rrFile) == 1 && ev.kind == kind && ev.len <= cap &&
+            fread(data, 1, ev.len, g_rrFile) == ev.len) {
+            *ret = ev.ret;
+            *len = ev.len;
+            g_rrEvents++;
+            ok = TRUE;
+        }
+        else {
+            g_rrExpected = feof(g_rrFile) ? RR_NONE : (RR_KIND)ev.kind;
+            g_rrGot = kind;     // different function, or a read() into a smaller buffer
+            g_rrLive = TRUE;
+            fseek(g_rrFile, pos, SEEK_SET);
+        }
+    }
+    PIN_ReleaseLock(&g_rrLock);
+    return ok;
+}
+
+// Top-level call on this thread and replay still in sync.
+inline BOOL RR_Replay(THREADID tid) { return g_rrReplaying && !g_rrLive && g_rrDepth[tid] == 0; }
+inline BOOL RR_Record(THREADID tid) { return !g_rrReplaying && g_rrDepth[tid] == 0; }
+
+/* ===================================================================== */
+/* Replacement Routines */
+/* ===================================================================== */
+
+static long RR_Time(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, long* t)
+{
+    INT64 ret;
+    UINT8 data[RR_PAYLOAD_MAX];
+    UINT32 len;
+    if (RR_Replay(tid) && RR_Get(tid, RR_TIME, &ret, data, sizeof(data), &len)) {
+        if (t) *t = ret;
+        return ret;
+    }
+
+    long r;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+        PIN_PARG(long), &r, PIN_PARG(long*), t, PIN_PARG_END());
+    g_rrDepth[tid]--;
+    if (RR_Record(tid)) RR_Put(tid, RR_TIME, r, 0, 0);
+    return r;
+}
+
+static int RR_GetTimeOfDay(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, struct timeval* tv, VOID* tz)
+{
+    INT64 ret;
+    UINT8 data[RR_PAYLOAD_MAX];
+    UINT32 len;
+    if (RR_Replay(tid) && RR_Get(tid, RR_GETTIMEOFDAY, &ret, data, sizeof(data), &len)) {
+        if (tv && len == sizeof(*tv)) memcpy(tv, data, len);
+        return (int)ret;
+    }
+
+    int r;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+        PIN_PARG(int), &r, PIN_PARG(struct timeval*), tv, PIN_PARG(VOID*), tz, PIN_PARG_END());
+    g_rrDepth[tid]--;
+    if (RR_Record(tid)) RR_Put(tid, RR_GETTIMEOFDAY, r, tv, tv ? sizeof(*tv) : 0);
+    return r;
+}
+
+static int RR_Rand(CONTEXT* ctxt, THREADID tid, AFUNPTR orig)
+{
+    INT64 ret;
+    UINT8 data[RR_PAYLOAD_MAX];
+    UINT32 len;
+    if (RR_Replay(tid) && RR_Get(tid, RR_RAND, &ret, data, sizeof(data), &len)) return (int)ret;
+
+    int r;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL, PIN_PARG(int), &r, PIN_PARG_END());
+    g_rrDepth[tid]--;
+    if (RR_Record(tid)) RR_Put(tid, RR_RAND, r, 0, 0);
+    return r;
+}
+
+static int RR_WGetCh(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, VOID* win)
+{
+    INT64 ret;
+    UINT8 data[RR_PAYLOAD_MAX];
+    UINT32 len;
+    if (RR_Replay(tid) && RR_Get(tid, RR_WGETCH, &ret, data, sizeof(data), &len)) return (int)ret;
+
+    int r;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+        PIN_PARG(int), &r, PIN_PARG(VOID*), win, PIN_PARG_END());
+    g_rrDepth[tid]--;
+    if (RR_Record(tid)) RR_Put(tid, RR_WGETCH, r, 0, 0);
+    return r;
+}
+
+static long RR_Read(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, int fd, VOID* buf, size_t count)
+{
+    INT64 ret;
+    UINT32 len;
+    // The payload goes straight into the caller's buffer
+    if (RR_Replay(tid) && RR_Get(tid, RR_READ, &ret, buf, count < 0xffffffffUL ? (UINT32)count : 0xffffffffU, &len)) return (long)ret;
+
+    long r;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+        PIN_PARG(long), &r, PIN_PARG(int), fd, PIN_PARG(VOID*), buf, PIN_PARG(size_t), count, PIN_PARG_END());
+    g_rrDepth[tid]--;
+    if (RR_Record(tid)) RR_Put(tid, RR_READ, r, buf, r > 0 ? (UINT32)r : 0);
+    return r;
+}
+
+// Payload: one presence byte (bit i: set i / timeout), then each present fd_set
+// (first (nfds + 7) / 8 bytes) and the remaining timeout.
+static int RR_Select(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, int nfds, fd_set* r, fd_set* w, fd_set* e,
+                     struct timeval* timeout)
+{
+    fd_set* sets[3] = { r, w, e };
+    UINT32 setBytes = nfds <= 0 ? 0 : (nfds + 7) / 8 > (int)sizeof(fd_set) ? sizeof(fd_set) : (nfds + 7) / 8;
+    INT64 ret;
+    UINT8 data[RR_PAYLOAD_MAX];
+    UINT32 len;
+
+    if (RR_Replay(tid) && RR_Get(tid, RR_SELECT, &ret, data, sizeof(data), &len)) {
+        UINT32 pos = 1;
+        for (int i = 0; i < 3; i++) {
+            if (!(data[0] & (1 << i)) || !sets[i]) continue;
+            memcpy(sets[i], data + pos, setBytes);
+            pos += setBytes;
+        }
+        if ((data[0] & 8) && timeout) memcpy(timeout, data + pos, sizeof(*timeout));
+        return (int)ret;
+    }
+
+    int res;
+    g_rrDepth[tid]++;
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+        PIN_PARG(int), &res, PIN_PARG(int), nfds, PIN_PARG(fd_set*), r, PIN_PARG(fd_set*), w,
+        PIN_PARG(fd_set*), e, PIN_PARG(struct timeval*), timeout, PIN_PARG_END());
+    g_rrDepth[tid]--;
+
+    if (RR_Record(tid)) {
+        data[0] = 0;
+        len = 1;
+        for (int i = 0; i < 3; i++) {
+            if (!sets[i]) continue;
+            data[0] |= 1 << i;
+            memcpy(data + len, sets[i], setBytes);
+            len += setBytes;
+        }
+        if (timeout) {
+            data[0] |= 8;
+            memcpy(data + len, timeout, sizeof(*timeout));
+            len += sizeof(*timeout);
+        }
+        RR_Put(tid, RR_SELECT, res, data, len);
+    }
+    return res;
+}
+
+/* ===================================================================== */
+
+static BOOL RR_Wanted(const char* name)
+{
+    std::string list = "," + KnobReplayFuncs.Value() + ",";
+    return list.find(std::string(",") + name + ",") != std::string::npos;
+}
+
+static VOID RR_ImageLoad(IMG img, VOID* v)
+{
+    if (IMG_IsMainExecutable(img)) return;
+
+    RTN rtn;
+    if (RR_Wanted("time") && RTN_Valid(rtn = RTN_FindByName(img, "time"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(long), CALLINGSTD_DEFAULT, "time", PIN_PARG(long*), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_Time, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        PROTO_Free(proto);
+    }
+    if (RR_Wanted("gettimeofday") && RTN_Valid(rtn = RTN_FindByName(img, "gettimeofday"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(int), CALLINGSTD_DEFAULT, "gettimeofday",
+            PIN_PARG(struct timeval*), PIN_PARG(VOID*), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_GetTimeOfDay, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_END);
+        PROTO_Free(proto);
+    }
+    if (RR_Wanted("rand") && RTN_Valid(rtn = RTN_FindByName(img, "rand"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(int), CALLINGSTD_DEFAULT, "rand", PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_Rand, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR, IARG_END);
+        PROTO_Free(proto);
+    }
+    if (RR_Wanted("wgetch") && RTN_Valid(rtn = RTN_FindByName(img, "wgetch"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(int), CALLINGSTD_DEFAULT, "wgetch", PIN_PARG(VOID*), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_WGetCh, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        PROTO_Free(proto);
+    }
+    if (RR_Wanted("read") && RTN_Valid(rtn = RTN_FindByName(img, "read"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(long), CALLINGSTD_DEFAULT, "read",
+            PIN_PARG(int), PIN_PARG(VOID*), PIN_PARG(size_t), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_Read, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_END);
+        PROTO_Free(proto);
+    }
+    if (RR_Wanted("select") && RTN_Valid(rtn = RTN_FindByName(img, "select"))) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(int), CALLINGSTD_DEFAULT, "select", PIN_PARG(int), PIN_PARG(fd_set*),
+            PIN_PARG(fd_set*), PIN_PARG(fd_set*), PIN_PARG(struct timeval*), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)RR_Select, IARG_PROTOTYPE, proto,
+            IARG_CONTEXT, IARG_THREAD_ID, IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 3, IARG_FUNCARG_ENTRYPOINT_VALUE, 4, IARG_END);
+        PROTO_Free(proto);
+    }
+}
+
+static VOID RR_Fini(INT32 code, VOID* v)
+{
+    if (g_rrReplaying && g_rrLive) {
+        fprintf(stderr, "[REPLAY] ran live after %llu events: program called %s, log has %s\n",
+            (unsigned long long)g_rrEvents, g_rrNames[g_rrGot], g_rrExpected ? g_rrNames[g_rrExpected] : "no more events");
+    }
+    else {
+        fprintf(stderr, "[%s] %llu events\n", g_rrReplaying ? "REPLAY" : "RECORD", (unsigned long long)g_rrEvents);
+    }
+    fclose(g_rrFile);
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init (needs PIN_InitSymbols). FALSE on a bad log file.
+BOOL Replay_Init()
+{
+    if (!KnobRecord.Value().empty() && !KnobReplay.Value().empty()) {
+        fprintf(stderr, "[REPLAY] -record and -replay are exclusive\n");
+        return FALSE;
+    }
+    if (KnobRecord.Value().empty() && KnobReplay.Value().empty()) return TRUE;
+
+    g_rrReplaying = !KnobReplay.Value().empty();
+    const std::string& path = g_rrReplaying ? KnobReplay.Value() : KnobRecord.Value();
+    g_rrFile = fopen(path.c_str(), g_rrReplaying ? "rb" : "wb");
+
+    char magic[8];
+    if (g_rrFile == 0 ||
+        (g_rrReplaying ? fread(magic, 1, 8, g_rrFile) != 8 || memcmp(magic, RR_MAGIC, 8) != 0
+                       : fwrite(RR_MAGIC, 1, 8, g_rrFile) != 8)) {
+        fprintf(stderr, "[REPLAY] cannot use %s\n", path.c_str());
+        return FALSE;
+    }
+
+    PIN_InitLock(&g_rrLock);
+    IMG_AddInstrumentFunction(RR_ImageLoad, 0);
+    PIN_AddFiniFunction(RR_Fini, 0);
+    return TRUE;
+}
+
+#endif // CS6501_REPLAY_H
@@ -0,0 +1,125 @@
+/*! @file
+ *  Ranked, symbolized top-N hit-count report for the cs6501 Pin tools.
+ *
+ *  Replaces the linear "offset: %lx, max-hitcount: %llu" dump over the whole
+ *  hit-count table: Fini keeps the N hottest offsets (partial sort) and prints each
+ *  with its routine, source file:line and disassembly, so flappybird.S / mine.S do
+ *  not have to be searched by hand. Symbols are captured at instrumentation time,
+ *  while the image is guaranteed to be loaded.
+ */
+
+#ifndef CS6501_REPORT_H
+#define CS6501_REPORT_H
+
+#include "pin.H"
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "cs6501_disasm.h"
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<UINT32> KnobTop(KNOB_MODE_WRITEONCE, "pintool", "top", "20",
+    "number of hottest offsets in the Fini report (0: all of them)");
+KNOB<std::string> KnobReportCsv(KNOB_MODE_WRITEONCE, "pintool", "report_csv", "",
+    "also write the Fini report as CSV to this file");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+struct REPORT_SITE {
+    std::string rtn;        // routine name, "" if Pin found none
+    ADDRINT rtnOffset;      // offset of the instruction inside the routine
+    std::string file;       // source file, "" without debug info
+    INT32 line;
+};
+
+static std::map<ADDRINT, REPORT_SITE> g_reportSites;   // image offset -> symbol info
+
+/* ===================================================================== */
+
+// CSV field: quoted, with embedded quotes doubled (operands contain commas).
+static VOID Report_CsvField(FILE* fp, const std::string& s)
+{
+    fputc('"', fp);
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"') fputc('"', fp);
+        fputc(s[i], fp);
+    }
+    fputc('"', fp);
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from Instruction() for every instrumented instruction. Needs PIN_InitSymbols().
+VOID Report_Symbolize(INS ins, ADDRINT offset)
+{
+    if (g_reportSites.find(offset) != g_reportSites.end()) return;
+
+    REPORT_SITE& site = g_reportSites[offset];
+    RTN rtn = INS_Rtn(ins);
+    site.rtn = RTN_Valid(rtn) ? RTN_Name(rtn) : "";
+    site.rtnOffset = RTN_Valid(rtn) ? INS_Address(ins) - RTN_Address(rtn) : 0;
+    site.line = 0;
+    PIN_GetSourceLocation(INS_Address(ins), 0, &site.line, &site.file);
+    Disasm_Get(ins, offset);
+}
+
+// Symbol info captured for offset, or an empty site if it was never symbolized.
+const REPORT_SITE& Report_Site(ADDRINT offset)
+{
+    static const REPORT_SITE unknown = { "", 0, "", 0 };
+    std::map<ADDRINT, REPORT_SITE>::const_iterator it = g_reportSites.find(offset);
+    return it == g_reportSites.end() ? unknown : it->second;
+}
+
+// Ends a report row: "  routine+0x..  file:line  disassembly".
+VOID Report_PrintSite(FILE* fp, ADDRINT offset)
+{
+    const REPORT_SITE& site = Report_Site(offset);
+    fprintf(fp, "  %s+0x%lx", site.rtn.empty() ? "?" : site.rtn.c_str(), site.rtnOffset);
+    if (!site.file.empty()) fprintf(fp, "  %s:%d", site.file.c_str(), site.line);
+    fprintf(fp, "  %s\n", Disasm_Lookup(offset));
+}
+
+// counts[offset] for offset < size; label names the count column ("max-hitcount").
+VOID Report_TopN(FILE* fp, const UINT64* counts, ADDRINT size, const char* label)
+{
+    std::vector<std::pair<UINT64, ADDRINT> > hot;
+    for (ADDRINT i = 0; i < size; i++) {
+        if (counts[i]) hot.push_back(std::make_pair(counts[i], i));
+    }
+    size_t n = KnobTop.Value() ? std::min<size_t>(KnobTop.Value(), hot.size()) : hot.size();
+    std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), std::greater<std::pair<UINT64, ADDRINT> >());
+
+    FILE* csv = KnobReportCsv.Value().empty() ? 0 : fopen(KnobReportCsv.Value().c_str(), "wt");
+    if (csv) fprintf(csv, "rank,offset,%s,routine,routine_offset,file,line,disasm\n", label);
+
+    fprintf(fp, "[REPORT] top %lu of %lu offsets\n", (unsigned long)n, (unsigned long)hot.size());
+    for (size_t i = 0; i < n; i++) {
+        ADDRINT offset = hot[i].second;
+        const REPORT_SITE& site = Report_Site(offset);
+
+        fprintf(fp, "#%lu offset: %lx, %s: %llu", (unsigned long)i + 1, offset, label, (unsigned long long)hot[i].first);
+        Report_PrintSite(fp, offset);
+
+        if (csv) {
+            fprintf(csv, "%lu,%lx,%llu,", (unsigned long)i + 1, offset, (unsigned long long)hot[i].first);
+            Report_CsvField(csv, site.rtn);
+            fprintf(csv, ",%lx,", site.rtnOffset);
+            Report_CsvField(csv, site.file);
+            fprintf(csv, ",%d,", site.line);
+            Report_CsvField(csv, Disasm_Lookup(offset));
+            fputc('\n', csv);
+        }
+    }
+    if (csv) fclose(csv);
+}
+
+#endif // CS6501_REPORT_H
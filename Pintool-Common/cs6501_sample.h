@@ -0,0 +1,231 @@
+/*! @file
+ *  Sampling mode for the write hit-count tools.
+ *
+ *  Instead of a full record on every non-stack store, each thread decrements a
+ *  countdown in an inlined If-call and only takes the Then-call once the
+ *  countdown reaches zero (every -sample N stores, period randomized around N),
+ *  or on the first store after a -sample_us T timer tick. The per-thread state
+ *  is reached through a Pin tool register, so the If-call stays inlinable.
+ *  Sample_Report scales the per-offset sample counts back to estimated hit counts
+ *  with 95% confidence intervals, symbolized and cut at -top like Report_TopN so
+ *  the two rankings can be compared line by line.
+ */
+
+#ifndef CS6501_SAMPLE_H
+#define CS6501_SAMPLE_H
+
+#include "pin.H"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+#include "cs6501_stack.h"
+#include "cs6501_report.h"
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<UINT64> KnobSample(KNOB_MODE_WRITEONCE, "pintool", "sample", "0",
+    "take one full record every N non-stack stores on average (0: record every store)");
+KNOB<UINT32> KnobSampleUs(KNOB_MODE_WRITEONCE, "pintool", "sample_us", "0",
+    "take one full record per thread every T microseconds instead of every N stores");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+struct SAMPLE_THREAD {
+    UINT64 left;            // stores until the next sample (countdown mode)
+    UINT64 period;          // period the countdown was armed with
+    UINT64 consumed;        // stores covered by finished periods
+    UINT64 seen;            // stores seen (timer mode)
+    volatile UINT64 fire;   // set by the timer thread (timer mode)
+    UINT64 samples;
+    UINT32 rng;
+};
+
+static REG g_sampleReg = REG_INVALID();
+static PIN_LOCK g_sampleLock;                   // guards g_sampleThreads
+static std::vector<SAMPLE_THREAD*> g_sampleThreads;
+static volatile BOOL g_sampleStop = FALSE;
+static PIN_THREAD_UID g_sampleTimerUid;
+
+/* ===================================================================== */
+
+// Uniform in [N/2, 3N/2): avoids locking onto loops whose trip count divides N.
+static UINT64 Sample_NextPeriod(SAMPLE_THREAD* st)
+{
+    UINT64 n = KnobSample.Value();
+    if (n < 2) return 1;
+    st->rng ^= st->rng << 13;
+    st->rng ^= st->rng >> 17;
+    st->rng ^= st->rng << 5;
+    return n / 2 + st->rng % n;
+}
+
+static VOID Sample_ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    SAMPLE_THREAD* st = new SAMPLE_THREAD();
+    st->rng = 0x9e3779b9u ^ (tid * 2654435761u);
+    st->period = st->left = Sample_NextPeriod(st);
+    PIN_SetContextReg(ctxt, g_sampleReg, (ADDRINT)st);
+
+    PIN_GetLock(&g_sampleLock, tid + 1);
+    g_sampleThreads.push_back(st);
+    PIN_ReleaseLock(&g_sampleLock);
+}
+
+static VOID Sample_TimerThread(VOID* v)
+{
+    THREADID tid = PIN_ThreadId();
+    while (!g_sampleStop && !PIN_IsProcessExiting()) {
+        usleep(KnobSampleUs.Value());
+        PIN_GetLock(&g_sampleLock, tid + 1);
+        for (size_t i = 0; i < g_sampleThreads.size(); i++) g_sampleThreads[i]->fire = 1;
+        PIN_ReleaseLock(&g_sampleLock);
+    }
+}
+
+static VOID Sample_PrepareForFini(VOID* v)
+{
+    g_sampleStop = TRUE;
+    PIN_WaitForThreadTermination(g_sampleTimerUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+/* ===================================================================== */
+/* If-routines (inlined) */
+/* ===================================================================== */
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL Sample_CountdownNotStack(SAMPLE_THREAD* st, ADDRINT low, ADDRINT high, ADDRINT mem)
+{
+    st->left -= (mem < low) | (mem >= high);
+    return st->left == 0;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL Sample_TimerNotStack(SAMPLE_THREAD* st, ADDRINT low, ADDRINT high, ADDRINT mem)
+{
+    ADDRINT notStack = (mem < low) | (mem >= high);
+    st->seen += notStack;
+    return st->fire & notStack;
+}
+
+// With -stack_keep: same, counting the kept stack frames too (walks the RBP
+// chain for stack writes, so these are not inlined)
+static ADDRINT PIN_FAST_ANALYSIS_CALL Sample_CountdownWanted(SAMPLE_THREAD* st, ADDRINT low, ADDRINT high, ADDRINT mem, ADDRINT rbp)
+{
+    st->left -= Stack_Wanted(low, high, mem, rbp);
+    return st->left == 0;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL Sample_TimerWanted(SAMPLE_THREAD* st, ADDRINT low, ADDRINT high, ADDRINT mem, ADDRINT rbp)
+{
+    ADDRINT wanted = Stack_Wanted(low, high, mem, rbp);
+    st->seen += wanted;
+    return st->fire & wanted;
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init. FALSE if no tool register is left.
+BOOL Sample_Init()
+{
+    if (KnobSample.Value() == 0 && KnobSampleUs.Value() == 0) return TRUE;
+    if (!Stack_Init()) return FALSE;
+
+    g_sampleReg = PIN_ClaimToolRegister();
+    if (!REG_valid(g_sampleReg)) {
+        fprintf(stderr, "[SAMPLE] no tool register available\n");
+        return FALSE;
+    }
+    PIN_InitLock(&g_sampleLock);
+    PIN_AddThreadStartFunction(Sample_ThreadStart, 0);
+    if (KnobSampleUs.Value()) {
+        PIN_SpawnInternalThread(Sample_TimerThread, 0, 0, &g_sampleTimerUid);
+        PIN_AddPrepareForFiniFunction(Sample_PrepareForFini, 0);
+    }
+    return TRUE;
+}
+
+inline BOOL Sample_Enabled() { return REG_valid(g_sampleReg); }
+
+// Tool register holding the thread's SAMPLE_THREAD*, for IARG_REG_VALUE in the Then-call.
+inline REG Sample_Reg() { return g_sampleReg; }
+
+// Replaces the Stack_InsertIfCall If-call for one written memory operand; stack
+// writes count towards the sample only in the -stack_keep frames.
+VOID Sample_InsertIfCall(INS ins, IPOINT where, UINT32 memOp)
+{
+    if (Stack_KeepAny()) {
+        INS_InsertIfCall(
+            ins, where, KnobSampleUs.Value() ? (AFUNPTR)Sample_TimerWanted : (AFUNPTR)Sample_CountdownWanted,
+            IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_sampleReg,
+            IARG_REG_VALUE, Stack_LowReg(),
+            IARG_REG_VALUE, Stack_HighReg(),
+            IARG_MEMORYOP_EA, memOp,
+            IARG_REG_VALUE, REG_RBP,
+            IARG_END);
+        return;
+    }
+    INS_InsertIfCall(
+        ins, where, KnobSampleUs.Value() ? (AFUNPTR)Sample_TimerNotStack : (AFUNPTR)Sample_CountdownNotStack,
+        IARG_FAST_ANALYSIS_CALL,
+        IARG_REG_VALUE, g_sampleReg,
+        IARG_REG_VALUE, Stack_LowReg(),
+        IARG_REG_VALUE, Stack_HighReg(),
+        IARG_MEMORYOP_EA, memOp,
+        IARG_END);
+}
+
+// First thing in the Then-call: re-arms the countdown / timer flag.
+inline VOID Sample_Rearm(SAMPLE_THREAD* st)
+{
+    st->samples++;
+    if (KnobSampleUs.Value()) {
+        st->fire = 0;
+        return;
+    }
+    st->consumed += st->period;
+    st->period = st->left = Sample_NextPeriod(st);
+}
+
+/*
+ * Writes the sampled offsets, hottest first. samples[] holds per-offset sample
+ * counts (the hit-count table filled from the Then-call). The estimate is
+ * share * total stores with a normal-approximation binomial interval; in timer
+ * mode the share is per tick rather than per store, so treat it as a ranking.
+ */
+VOID Sample_Report(FILE* fp, const UINT64* samples, ADDRINT size)
+{
+    UINT64 writes = 0, n = 0;
+    for (size_t t = 0; t < g_sampleThreads.size(); t++) {
+        const SAMPLE_THREAD* st = g_sampleThreads[t];
+        writes += KnobSampleUs.Value() ? st->seen : st->consumed + (st->period - st->left);
+        n += st->samples;
+    }
+    fprintf(fp, "[SAMPLE] %llu of %llu non-stack stores sampled\n", (unsigned long long)n, (unsigned long long)writes);
+    if (n == 0) return;
+
+    std::vector<std::pair<UINT64, ADDRINT> > hot;
+    for (ADDRINT i = 0; i < size; i++) {
+        if (samples[i]) hot.push_back(std::make_pair(samples[i], i));
+    }
+    size_t top = KnobTop.Value() ? std::min<size_t>(KnobTop.Value(), hot.size()) : hot.size();
+    std::partial_sort(hot.begin(), hot.begin() + top, hot.end(), std::greater<std::pair<UINT64, ADDRINT> >());
+
+    fprintf(fp, "[REPORT] top %lu of %lu offsets\n", (unsigned long)top, (unsigned long)hot.size());
+    for (size_t i = 0; i < top; i++) {
+        double p = (double)hot[i].first / n;
+        double half = 1.96 * sqrt(p * (1 - p) / n);
+        double lo = std::max(0.0, p - half) * writes, hi = std::min(1.0, p + half) * writes;
+        fprintf(fp, "#%lu offset: %lx, est-hitcount: %llu (95%%: %llu - %llu, samples: %llu)", (unsigned long)i + 1,
+            hot[i].second, (unsigned long long)(p * writes), (unsigned long long)lo, (unsigned long long)hi,
+            (unsigned long long)hot[i].first);
+        Report_PrintSite(fp, hot[i].second);
+    }
+}
+
+#endif // CS6501_SAMPLE_H
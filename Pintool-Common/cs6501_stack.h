@@ -0,0 +1,200 @@
+/*! @file
+ *  Exact per-thread stack bounds for the cs6501 Pin tools.
+ *
+ *  Replaces IsStackMem_Heuristic (anything within +-0x10000 of RSP), which drops
+ *  heap data that happens to sit near the stack and costs a call per store. Each
+ *  thread's bounds are taken once at thread start: the mapping that holds the
+ *  initial RSP, and for the main thread ([stack], which grows) RLIMIT_STACK below
+ *  its top. They live in two tool registers, which Pin keeps per thread like any
+ *  other register, so the If-call that filters stack writes is two compares on
+ *  register values and stays inlined.
+ *
+ *  -stack_keep lists frame depths whose stack writes are kept anyway, counted
+ *  along the RBP chain from the writing function: 0 = its own locals (flappybird's
+ *  `collision` in main), 1 = its caller's frame (out-parameters), ...
+ */
+
+#ifndef CS6501_STACK_H
+#define CS6501_STACK_H
+
+#include "pin.H"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobStackKeep(KNOB_MODE_WRITEONCE, "pintool", "stack_keep", "",
+    "frame depths whose stack writes are kept (0: the writer's own frame, 1: its caller's, ...), e.g. 0 or 0,2-3 or 1- or all; default: drop all");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define STACK_DEPTH_MAX 63          // depths from here on share the last mask bit
+
+struct STACK_BOUNDS {
+    ADDRINT low, high;              // [low, high)
+};
+
+static BOOL g_stackInit = FALSE;
+static REG g_stackLowReg = REG_INVALID(), g_stackHighReg = REG_INVALID();
+static UINT64 g_stackKeep = 0;      // bit d: keep writes into frame depth d
+
+/* ===================================================================== */
+
+// "0,2-3,5-" -> bits 0, 2, 3 and 5..63. FALSE on a malformed list.
+static BOOL Stack_ParseKeep(const std::string& text, UINT64* mask)
+{
+    *mask = 0;
+    if (text == "all") {
+        *mask = ~0ULL;
+        return TRUE;
+    }
+    const char* p = text.c_str();
+    while (*p) {
+        char* end;
+        unsigned long first = strtoul(p, &end, 10), last = first;
+        if (end == p) return FALSE;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = (*p >= '0' && *p <= '9') ? strtoul(p, &end, 10) : STACK_DEPTH_MAX;
+            p = (*p >= '0' && *p <= '9') ? end : p;
+        }
+        if (last < first) return FALSE;
+        for (unsigned long d = first; d <= last && d <= STACK_DEPTH_MAX; d++) *mask |= 1ULL << d;
+        if (*p == ',') p++;
+        else if (*p) return FALSE;
+    }
+    return TRUE;
+}
+
+// Bounds of the stack holding rsp, from /proc/self/maps and RLIMIT_STACK.
+static STACK_BOUNDS Stack_Find(ADDRINT rsp)
+{
+    STACK_BOUNDS b;
+    b.low = rsp & ~(ADDRINT)0xfff;
+    b.high = b.low + 0x1000;
+
+    FILE* fp = fopen("/proc/self/maps", "rt");
+    if (fp == 0) return b;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long start, end;
+        char name[256] = "";
+        if (sscanf(line, "%llx-%llx %*s %*s %*s %*s %255s", &start, &end, name) < 2) continue;
+        if (rsp < start || rsp >= end) continue;
+
+        b.low = start;
+        b.high = end;
+        if (strcmp(name, "[stack]") == 0) {
+            // The main stack grows on demand, up to RLIMIT_STACK below its top
+            struct rlimit rl;
+            ADDRINT limit = 8 << 20;
+            if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) limit = rl.rlim_cur;
+            if (limit < end - start) limit = end - start;
+            b.low = end - limit;
+        }
+        break;
+    }
+    fclose(fp);
+    return b;
+}
+
+static VOID Stack_ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    STACK_BOUNDS b = Stack_Find(PIN_GetContextReg(ctxt, REG_STACK_PTR));
+    PIN_SetContextReg(ctxt, g_stackLowReg, b.low);
+    PIN_SetContextReg(ctxt, g_stackHighReg, b.high);
+}
+
+// Frame of the RBP chain holding mem: 0 = [rsp, rbp + 16), the current frame with
+// its saved RBP and return address, then one more per saved RBP.
+static UINT32 Stack_FrameDepth(ADDRINT low, ADDRINT high, ADDRINT mem, ADDRINT rbp)
+{
+    UINT32 depth = 0;
+    while (depth < STACK_DEPTH_MAX && mem >= rbp + 16) {
+        if (rbp < low || rbp + 16 > high) return STACK_DEPTH_MAX;     // not a frame pointer
+        ADDRINT next = *(ADDRINT*)rbp;
+        if (next <= rbp) return STACK_DEPTH_MAX;
+        rbp = next;
+        depth++;
+    }
+    return depth;
+}
+
+/* ===================================================================== */
+/* If-routines */
+/* ===================================================================== */
+
+// Inlined: two compares on tool registers
+static ADDRINT PIN_FAST_ANALYSIS_CALL Stack_NotStack(ADDRINT low, ADDRINT high, ADDRINT mem)
+{
+    return (mem < low) | (mem >= high);
+}
+
+// With -stack_keep: walks the RBP chain for stack writes, so it is not inlined
+static ADDRINT PIN_FAST_ANALYSIS_CALL Stack_Wanted(ADDRINT low, ADDRINT high, ADDRINT mem, ADDRINT rbp)
+{
+    if ((mem < low) | (mem >= high)) return 1;
+    return (g_stackKeep >> Stack_FrameDepth(low, high, mem, rbp)) & 1;
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+// Call from main() after PIN_Init. FALSE on a bad -stack_keep or no tool registers left.
+BOOL Stack_Init()
+{
+    if (g_stackInit) return TRUE;
+
+    if (!Stack_ParseKeep(KnobStackKeep.Value(), &g_stackKeep)) {
+        fprintf(stderr, "[STACK] bad -stack_keep %s\n", KnobStackKeep.Value().c_str());
+        return FALSE;
+    }
+    g_stackLowReg = PIN_ClaimToolRegister();
+    g_stackHighReg = PIN_ClaimToolRegister();
+    if (!REG_valid(g_stackLowReg) || !REG_valid(g_stackHighReg)) {
+        fprintf(stderr, "[STACK] no tool register available\n");
+        return FALSE;
+    }
+    PIN_AddThreadStartFunction(Stack_ThreadStart, 0);
+    g_stackInit = TRUE;
+    return TRUE;
+}
+
+// TRUE if -stack_keep lists any frame depth (the filter then needs RBP).
+inline BOOL Stack_KeepAny() { return g_stackKeep != 0; }
+
+// Tool registers holding the thread's stack bounds, for IARG_REG_VALUE.
+inline REG Stack_LowReg() { return g_stackLowReg; }
+inline REG Stack_HighReg() { return g_stackHighReg; }
+
+// Replaces the IsNotStackMem If-call: the Then-call runs for non-stack accesses
+// (and for stack accesses into the -stack_keep frames).
+VOID Stack_InsertIfCall(INS ins, IPOINT where, UINT32 memOp)
+{
+    if (g_stackKeep == 0) {
+        INS_InsertIfCall(
+            ins, where, (AFUNPTR)Stack_NotStack, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_stackLowReg,
+            IARG_REG_VALUE, g_stackHighReg,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_END);
+        return;
+    }
+    INS_InsertIfCall(
+        ins, where, (AFUNPTR)Stack_Wanted, IARG_FAST_ANALYSIS_CALL,
+        IARG_REG_VALUE, g_stackLowReg,
+        IARG_REG_VALUE, g_stackHighReg,
+        IARG_MEMORYOP_EA, memOp,
+        IARG_REG_VALUE, REG_RBP,
+        IARG_END);
+}
+
+#endif // CS6501_STACK_H
@@ -0,0 +1,925 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Byte-level taint tracking from keyboard input to game state.
+ *
+ *  Sources: the return value of wgetch (-taint_rtn) and the bytes read() puts in
+ *  its buffer for the fds in -taint_fds. Every byte of memory and of the general
+ *  purpose / XMM registers carries a label (1 getch, 2 read, 0x80 through a
+ *  branch). Memory labels live in a two-level shadow: a lazily mapped top table
+ *  indexed by address >> 20 pointing to 1 MB chunks, allocated on the first
+ *  tainted store into them.
+ *
+ *  Fast path: per thread, a tool register holds one bit per register slot that
+ *  has a tainted byte. Each instruction gets an inlined If-call that ANDs it with
+ *  the instruction's register mask and probes the shadow bytes of its memory
+ *  operand (branch-free, a clean chunk stands in for missing ones); only when
+ *  something is tainted does the Then-call propagate byte by byte.
+ *
+ *  -taint_ctrl: a conditional branch on tainted flags taints every write of its
+ *  function (and its callees) up to the branch's immediate post-dominator,
+ *  computed per routine at image load. That is how `collision` (a constant
+ *  returned by controlCollision after comparing birdRow) and `isOver = true` get
+ *  their label. Backward branches are loop tests and are left out.
+ *  -taint_addr: a load through a tainted pointer or index (moon-buggy's key hash
+ *  table) carries the pointer's label.
+ *
+ *  Only the images picked by cs6501_imagemap.h (main + -libs) are instrumented;
+ *  calls into the others clear the caller-saved registers' labels.
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "cs6501_imagemap.h"
+#include "cs6501_replay.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutput(KNOB_MODE_WRITEONCE, "pintool", "o", "taint.txt",
+    "report file");
+KNOB<string> KnobTaintRtn(KNOB_MODE_WRITEONCE, "pintool", "taint_rtn", "wgetch",
+    "comma-separated routines whose return value is keyboard input");
+KNOB<string> KnobTaintFds(KNOB_MODE_WRITEONCE, "pintool", "taint_fds", "0",
+    "comma-separated fds whose read() buffers are tainted ('all', or '' for none)");
+KNOB<string> KnobTaintSink(KNOB_MODE_WRITEONCE, "pintool", "taint_sink", "",
+    "comma-separated main-image store offsets (hex) reported on every execution, e.g. 1c6b,1d8c");
+KNOB<BOOL> KnobTaintCtrl(KNOB_MODE_WRITEONCE, "pintool", "taint_ctrl", "1",
+    "taint writes that depend on a tainted branch, up to its post-dominator");
+KNOB<BOOL> KnobTaintAddr(KNOB_MODE_WRITEONCE, "pintool", "taint_addr", "1",
+    "loads through a tainted pointer / index are tainted");
+KNOB<UINT32> KnobTop(KNOB_MODE_WRITEONCE, "pintool", "top", "50",
+    "store sites in the report (0: all)");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+#define TAINT_GETCH         0x01
+#define TAINT_READ          0x02
+#define TAINT_CTRL          0x80
+
+#define TAINT_CHUNK_BITS    20
+#define TAINT_CHUNK_SIZE    (1UL << TAINT_CHUNK_BITS)
+#define TAINT_TOP_ENTRIES   (1UL << (47 - TAINT_CHUNK_BITS))    // user space is 47 bits
+
+#define TAINT_SLOT_XMM      16      // 16 GPR slots, then XMM0..15, then the flags
+#define TAINT_SLOT_FLAGS    32
+#define TAINT_SLOTS         33
+#define TAINT_SLOT_NONE     0xff
+#define TAINT_MAX_REGS      8
+#define TAINT_SCOPES        32
+
+// rax, rcx, rdx, rsi, rdi, r8-r11, xmm0-15, flags: not preserved across a call
+#define TAINT_CALLER_SAVED  (0x0f3dULL | 0xffffULL << TAINT_SLOT_XMM | 1ULL << TAINT_SLOT_FLAGS)
+
+static const REG g_gprs[16] = { REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15 };
+
+// Bytes [offset, offset + width) of a register slot.
+struct TAINT_REG {
+    UINT8 slot, offset, width;
+    BOOL zeroUpper;                 // 32-bit GPR write: bytes 4..7 become 0
+};
+
+enum TAINT_KIND {
+    TAINT_UNION,                    // every destination byte = OR of all source bytes
+    TAINT_COPY,                     // mov, movzx/movsx, push, pop: byte i from byte i
+    TAINT_CLEAR,                    // xor eax, eax; call (return address)
+};
+
+struct TAINT_INS {
+    ADDRINT offset;
+    string where;                   // routine, "lib`routine" outside the main image
+    TAINT_KIND kind;
+    BOOL signExtend;
+    BOOL ctrl;                      // writes pick up the label of enclosing branches
+    BOOL memRead, memWrite;
+    UINT32 nSrc, nDst, nAddr;
+    TAINT_REG src[TAINT_MAX_REGS], dst[TAINT_MAX_REGS], addr[2];
+    ADDRINT mask;                   // register slot bits of src, dst and addr
+    BOOL sink;
+    // store statistics; every execution for sinks, slow path only otherwise
+    UINT64 stores, tainted, viaCtrl;
+    UINT8 labels;
+};
+
+// Writes of the frame at rsp and its callees get 'label' until 'join' runs (0: the frame returns).
+struct TAINT_SCOPE {
+    ADDRINT rsp, join;
+    UINT8 label;
+};
+
+struct TAINT_THREAD {
+    UINT8 regs[TAINT_SLOTS][16];
+    TAINT_SCOPE scopes[TAINT_SCOPES];   // outermost (highest rsp) first
+    UINT32 numScopes;
+    INT64 sysFd;                        // read() in progress: fd and buffer, -1 otherwise
+    ADDRINT sysBuf;
+};
+
+static UINT8** g_taintTop;                              // address >> 20 -> chunk, 0 = clean
+static UINT8 g_taintClean[TAINT_CHUNK_SIZE + 8];        // stands in for missing chunks
+static vector<UINT8*> g_taintChunks;                   // allocated chunks, for the report
+static PIN_LOCK g_taintLock;
+
+static REG g_threadReg, g_summaryReg, g_scopeReg;      // TAINT_THREAD*, slot bits, outermost scope rsp
+static BOOL g_ctrl, g_addr;
+static set<string> g_srcRtns;
+static set<INT64> g_srcFds;
+static BOOL g_allFds = FALSE;
+static set<ADDRINT> g_sinks;
+
+static unordered_map<ADDRINT, TAINT_INS*> g_taintIns;   // by instruction address
+static unordered_map<ADDRINT, ADDRINT> g_joins;         // conditional branch -> post-dominator (0: return)
+static set<ADDRINT> g_joinSites;
+static UINT64 g_getchCalls = 0, g_readBytes = 0, g_branches = 0;
+
+FILE* g_fpOut = 0;
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool tracks which registers, memory bytes and store sites depend on keyboard input.\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Shadow Memory */
+/* ===================================================================== */
+
+static UINT8* TaintChunk(ADDRINT ea)
+{
+    return g_taintTop[(ea >> TAINT_CHUNK_BITS) & (TAINT_TOP_ENTRIES - 1)];
+}
+
+static UINT8 TaintGetMem(ADDRINT ea, UINT8* labels, UINT32 size)
+{
+    UINT8 any = 0;
+    for (UINT32 i = 0; i < size; i++) {
+        UINT8* chunk = TaintChunk(ea + i);
+        labels[i] = chunk ? chunk[(ea + i) & (TAINT_CHUNK_SIZE - 1)] : 0;
+        any |= labels[i];
+    }
+    return any;
+}
+
+static VOID TaintSetMem(ADDRINT ea, const UINT8* labels, UINT32 size)
+{
+    for (UINT32 i = 0; i < size; i++) {
+        UINT8*& chunk = g_taintTop[((ea + i) >> TAINT_CHUNK_BITS) & (TAINT_TOP_ENTRIES - 1)];
+        if (chunk == 0) {
+            if (labels[i] == 0) continue;
+            PIN_GetLock(&g_taintLock, PIN_ThreadId() + 1);
+            if (chunk == 0) {
+                chunk = (UINT8*)calloc(TAINT_CHUNK_SIZE + 8, 1);
+                g_taintChunks.push_back(chunk);
+            }
+            PIN_ReleaseLock(&g_taintLock);
+        }
+        chunk[(ea + i) & (TAINT_CHUNK_SIZE - 1)] = labels[i];
+    }
+}
+
+static VOID TaintFillMem(ADDRINT ea, ADDRINT size, UINT8 label)
+{
+    UINT8 labels[256];
+    memset(labels, label, sizeof(labels));
+    for (ADDRINT done = 0; done < size; done += sizeof(labels)) {
+        TaintSetMem(ea + done, labels, (UINT32)min<ADDRINT>(size - done, sizeof(labels)));
+    }
+}
+
+// Branch-free: any label in the first bytes of [ea, ea + 8) under sizeMask. The last
+// 8 bytes of a chunk always answer yes, so a store across two chunks is not missed.
+static inline ADDRINT TaintProbe(ADDRINT ea, ADDRINT sizeMask)
+{
+    ADDRINT chunk = (ADDRINT)g_taintTop[(ea >> TAINT_CHUNK_BITS) & (TAINT_TOP_ENTRIES - 1)];
+    chunk |= (ADDRINT)g_taintClean & (0 - (ADDRINT)(chunk == 0));
+    ADDRINT off = ea & (TAINT_CHUNK_SIZE - 1);
+    return (*(UINT64*)(chunk + off) & sizeMask) | ((off + 8) >> TAINT_CHUNK_BITS);
+}
+
+/* ===================================================================== */
+/* Registers and Scopes */
+/* ===================================================================== */
+
+static TAINT_REG TaintRegOf(REG reg)
+{
+    TAINT_REG r = { TAINT_SLOT_NONE, 0, 0, FALSE };
+    if (reg == REG_RFLAGS || reg == REG_EFLAGS || reg == REG_FLAGS) {
+        r.slot = TAINT_SLOT_FLAGS;
+        r.width = 1;
+    }
+    else if (REG_is_xmm(reg)) {
+        r.slot = TAINT_SLOT_XMM + (reg - REG_XMM0);
+        r.width = 16;
+    }
+    else if (REG_is_ymm(reg)) {
+        r.slot = TAINT_SLOT_XMM + (reg - REG_YMM0);     // the upper half is not tracked
+        r.width = 16;
+    }
+    else {
+        REG full = REG_FullRegName(reg);
+        for (UINT8 i = 0; i < 16; i++) {
+            if (g_gprs[i] != full || full == REG_RSP) continue;
+            r.slot = i;
+            r.offset = REG_is_Upper8(reg) ? 1 : 0;
+            r.width = REG_Size(reg);
+            r.zeroUpper = r.width == 4;
+            break;
+        }
+    }
+    return r;
+}
+
+static UINT8 TaintRegLabel(const TAINT_THREAD* t, const TAINT_REG& r)
+{
+    UINT8 any = 0;
+    for (UINT32 i = 0; i < r.width; i++) any |= t->regs[r.slot][r.offset + i];
+    return any;
+}
+
+static VOID TaintSummarize(const TAINT_THREAD* t, ADDRINT* summary, UINT32 slot)
+{
+    UINT64 word[2];
+    memcpy(word, t->regs[slot], 16);
+    if (word[0] | word[1]) *summary |= 1ULL << slot;
+    else *summary &= ~(1ULL << slot);
+}
+
+// Label of the branches this frame (and its callers' scopes reaching into it) depend on.
+static UINT8 TaintCtrlLabel(const TAINT_THREAD* t, ADDRINT rsp)
+{
+    UINT8 label = 0;
+    for (UINT32 i = 0; i < t->numScopes; i++) {
+        if (rsp <= t->scopes[i].rsp) label |= t->scopes[i].label;
+    }
+    return label;
+}
+
+static VOID TaintPublishScopes(const TAINT_THREAD* t, ADDRINT* scopeReg)
+{
+    *scopeReg = t->numScopes ? t->scopes[0].rsp : 0;
+}
+
+/* ===================================================================== */
+/* If-routines (inlined) */
+/* ===================================================================== */
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_R(ADDRINT summary, ADDRINT mask, ADDRINT rsp, ADDRINT scope)
+{
+    return (summary & mask) | (rsp <= scope);
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_M(ADDRINT summary, ADDRINT mask, ADDRINT rsp, ADDRINT scope,
+    ADDRINT ea, ADDRINT sizeMask)
+{
+    return (summary & mask) | (rsp <= scope) | TaintProbe(ea, sizeMask);
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_MM(ADDRINT summary, ADDRINT mask, ADDRINT rsp, ADDRINT scope,
+    ADDRINT readEa, ADDRINT readMask, ADDRINT writeEa, ADDRINT writeMask)
+{
+    return (summary & mask) | (rsp <= scope) | TaintProbe(readEa, readMask) | TaintProbe(writeEa, writeMask);
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_Mask(ADDRINT summary, ADDRINT mask)
+{
+    return summary & mask;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_InScope(ADDRINT rsp, ADDRINT scope)
+{
+    return rsp <= scope;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL TaintIf_AnyScope(ADDRINT scope)
+{
+    return scope != 0;
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+// Slow path: propagates the labels of one instruction.
+VOID TaintIns(TAINT_THREAD* t, ADDRINT* summary, TAINT_INS* ti, ADDRINT readEa, UINT32 readSize,
+    ADDRINT writeEa, UINT32 writeSize, ADDRINT rsp)
+{
+    UINT8 ctrl = ti->ctrl ? TaintCtrlLabel(t, rsp) : 0;
+    UINT8 val[32], any = 0;
+    UINT32 width = 0;
+
+    UINT8 addr = 0;
+    for (UINT32 i = 0; i < ti->nAddr; i++) addr |= TaintRegLabel(t, ti->addr[i]);
+
+    if (ti->kind == TAINT_COPY) {
+        if (ti->memRead) {
+            width = min<UINT32>(readSize, sizeof(val));
+            TaintGetMem(readEa, val, width);
+        }
+        else if (ti->nSrc) {
+            const TAINT_REG& r = ti->src[0];
+            width = r.width;
+            memcpy(val, &t->regs[r.slot][r.offset], width);
+        }
+        for (UINT32 i = 0; i < width; i++) val[i] |= addr;
+    }
+    else if (ti->kind == TAINT_UNION) {
+        for (UINT32 i = 0; i < ti->nSrc; i++) any |= TaintRegLabel(t, ti->src[i]);
+        if (ti->memRead) {
+            UINT32 n = min<UINT32>(readSize, sizeof(val));
+            any |= TaintGetMem(readEa, val, n);
+        }
+        any |= addr;
+    }
+
+    // Destination byte i
+    #define TAINT_BYTE(i) ((ti->kind == TAINT_COPY ? ((i) < width ? val[i] : (ti->signExtend && width ? val[width - 1] : 0)) \
+                                                   : ti->kind == TAINT_UNION ? any : 0) | ctrl)
+
+    for (UINT32 d = 0; d < ti->nDst; d++) {
+        const TAINT_REG& r = ti->dst[d];
+        UINT8* s = t->regs[r.slot];
+        for (UINT32 i = 0; i < r.width; i++) s[r.offset + i] = TAINT_BYTE(i);
+        if (r.zeroUpper) memset(s + 4, ctrl, 4);
+        TaintSummarize(t, summary, r.slot);
+    }
+
+    if (ti->memWrite) {
+        UINT8 out[64], all = 0;
+        UINT32 n = min<UINT32>(writeSize, sizeof(out));
+        for (UINT32 i = 0; i < n; i++) {
+            out[i] = TAINT_BYTE(i);
+            all |= out[i];
+        }
+        TaintSetMem(writeEa, out, n);
+        if (writeSize > n) TaintFillMem(writeEa + n, writeSize - n, ti->kind == TAINT_UNION ? any | ctrl : ctrl);
+
+        ti->stores++;
+        if (all) {
+            ti->tainted++;
+            ti->labels |= all;
+            if (all & TAINT_CTRL) ti->viaCtrl++;
+        }
+    }
+    #undef TAINT_BYTE
+}
+
+// Conditional branch on tainted flags: opens a scope up to its post-dominator.
+VOID TaintBranch(TAINT_THREAD* t, ADDRINT* scopeReg, ADDRINT join, ADDRINT rsp)
+{
+    g_branches++;
+    UINT8 label = t->regs[TAINT_SLOT_FLAGS][0] | TAINT_CTRL;
+    if (t->numScopes) {
+        TAINT_SCOPE& top = t->scopes[t->numScopes - 1];
+        // a second test of the same if (a && b) widens its scope; a full stack widens the innermost
+        if ((top.rsp == rsp && top.join == join) || t->numScopes == TAINT_SCOPES) {
+            top.label |= label;
+            return;
+        }
+    }
+    TAINT_SCOPE s = { rsp, join, label };
+    t->scopes[t->numScopes++] = s;
+    TaintPublishScopes(t, scopeReg);
+}
+
+// A post-dominator ends the scopes of this frame that wait for it.
+VOID TaintJoin(TAINT_THREAD* t, ADDRINT* scopeReg, ADDRINT ip, ADDRINT rsp)
+{
+    while (t->numScopes && t->scopes[t->numScopes - 1].rsp == rsp && t->scopes[t->numScopes - 1].join == ip) {
+        t->numScopes--;
+    }
+    TaintPublishScopes(t, scopeReg);
+}
+
+// ret: the scopes of the returning frame and below end.
+VOID TaintRet(TAINT_THREAD* t, ADDRINT* scopeReg, ADDRINT rsp)
+{
+    while (t->numScopes && t->scopes[t->numScopes - 1].rsp < rsp) t->numScopes--;
+    TaintPublishScopes(t, scopeReg);
+}
+
+// Entry of a routine that is not instrumented: its results are not tracked.
+VOID TaintOpaqueCall(TAINT_THREAD* t, ADDRINT* summary)
+{
+    for (UINT32 slot = 0; slot < TAINT_SLOTS; slot++) {
+        if (TAINT_CALLER_SAVED & (1ULL << slot)) memset(t->regs[slot], 0, 16);
+    }
+    *summary &= ~TAINT_CALLER_SAVED;
+}
+
+// Exit of a -taint_rtn routine: its int return value is input.
+VOID TaintSourceRet(TAINT_THREAD* t, ADDRINT* summary)
+{
+    g_getchCalls++;
+    for (UINT32 i = 0; i < 4; i++) t->regs[0][i] |= TAINT_GETCH;
+    *summary |= 1ULL << 0;
+}
+
+VOID SyscallEntry(THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD std, VOID* v)
+{
+    TAINT_THREAD* t = (TAINT_THREAD*)PIN_GetContextReg(ctxt, g_threadReg);
+    t->sysFd = -1;
+    if (PIN_GetSyscallNumber(ctxt, std) != SYS_read) return;
+    t->sysFd = (INT64)PIN_GetSyscallArgument(ctxt, std, 0);
+    t->sysBuf = PIN_GetSyscallArgument(ctxt, std, 1);
+}
+
+// The kernel filled the buffer: input for -taint_fds, clean for any other fd.
+VOID SyscallExit(THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD std, VOID* v)
+{
+    TAINT_THREAD* t = (TAINT_THREAD*)PIN_GetContextReg(ctxt, g_threadReg);
+    if (t->sysFd < 0) return;
+    ADDRINT ret = PIN_GetSyscallReturn(ctxt, std);
+    if ((INT64)ret > 0) {
+        BOOL input = g_allFds || g_srcFds.count(t->sysFd);
+        TaintFillMem(t->sysBuf, ret, input ? TAINT_READ : 0);
+        if (input) g_readBytes += ret;
+    }
+    t->sysFd = -1;
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    TAINT_THREAD* t = new TAINT_THREAD();
+    t->sysFd = -1;
+    PIN_SetContextReg(ctxt, g_threadReg, (ADDRINT)t);
+    PIN_SetContextReg(ctxt, g_summaryReg, 0);
+    PIN_SetContextReg(ctxt, g_scopeReg, 0);
+}
+
+/* ===================================================================== */
+/* Post-dominators */
+/* ===================================================================== */
+
+static UINT32 Intersect(const vector<UINT32>& ipdom, const vector<UINT32>& po, UINT32 a, UINT32 b)
+{
+    while (a != b) {
+        while (po[a] < po[b]) a = ipdom[a];
+        while (po[b] < po[a]) b = ipdom[b];
+    }
+    return a;
+}
+
+// Immediate post-dominator of each forward conditional branch of rtn, one node
+// per instruction plus an exit node (ret, indirect jumps, leaving the routine).
+// Cooper, Harvey & Kennedy's iterative dominators on the reversed graph.
+static VOID FindJoins(RTN rtn)
+{
+    vector<ADDRINT> addrs;
+    vector<ADDRINT> targets;        // direct control-flow target, 0 if none
+    vector<UINT8> kinds;            // 0 falls through, 1 jcc, 2 jmp, 3 exit
+    RTN_Open(rtn);
+    for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
+        addrs.push_back(INS_Address(ins));
+        UINT8 kind = 0;
+        ADDRINT target = 0;
+        if (INS_IsRet(ins) || (INS_IsIndirectControlFlow(ins) && !INS_IsCall(ins))) kind = 3;
+        else if (INS_IsBranch(ins) && INS_IsDirectControlFlow(ins)) {
+            kind = INS_HasFallThrough(ins) ? 1 : 2;
+            target = INS_DirectControlFlowTargetAddress(ins);
+        }
+        kinds.push_back(kind);
+        targets.push_back(target);
+    }
+    RTN_Close(rtn);
+
+    UINT32 n = addrs.size(), exitNode = n;
+    if (n == 0) return;
+    vector<vector<UINT32> > succ(n + 1), pred(n + 1);
+    for (UINT32 i = 0; i < n; i++) {
+        if (kinds[i] == 3) succ[i].push_back(exitNode);
+        if (kinds[i] == 0 || kinds[i] == 1) succ[i].push_back(i + 1 < n ? i + 1 : exitNode);
+        if (kinds[i] == 1 || kinds[i] == 2) {
+            vector<ADDRINT>::iterator it = lower_bound(addrs.begin(), addrs.end(), targets[i]);
+            succ[i].push_back(it != addrs.end() && *it == targets[i] ? (UINT32)(it - addrs.begin()) : exitNode);
+        }
+        for (size_t s = 0; s < succ[i].size(); s++) pred[succ[i][s]].push_back(i);
+    }
+
+    // Postorder of the reversed graph from the exit node
+    const UINT32 none = ~0U;
+    vector<UINT32> po(n + 1, none), order;
+    vector<pair<UINT32, UINT32> > stack(1, make_pair(exitNode, 0U));
+    vector<bool> seen(n + 1, false);
+    seen[exitNode] = true;
+    while (!stack.empty()) {
+        pair<UINT32, UINT32>& top = stack.back();
+        if (top.second < pred[top.first].size()) {
+            UINT32 p = pred[top.first][top.second++];
+            if (!seen[p]) {
+                seen[p] = true;
+                stack.push_back(make_pair(p, 0U));
+            }
+            continue;
+        }
+        po[top.first] = order.size();
+        order.push_back(top.first);
+        stack.pop_back();
+    }
+
+    vector<UINT32> ipdom(n + 1, none);
+    ipdom[exitNode] = exitNode;
+    for (BOOL changed = TRUE; changed;) {
+        changed = FALSE;
+        for (size_t k = order.size() - 1; k-- > 0;) {      // reverse postorder, exit node skipped
+            UINT32 b = order[k], pd = none;
+            for (size_t s = 0; s < succ[b].size(); s++) {
+                UINT32 c = succ[b][s];
+                if (ipdom[c] == none) continue;
+                pd = pd == none ? c : Intersect(ipdom, po, c, pd);
+            }
+            if (pd != ipdom[b]) {
+                ipdom[b] = pd;
+                changed = TRUE;
+            }
+        }
+    }
+
+    for (UINT32 i = 0; i < n; i++) {
+        if (kinds[i] != 1 || targets[i] <= addrs[i]) continue;      // loop tests open no scope
+        ADDRINT join = (ipdom[i] == none || ipdom[i] == exitNode) ? 0 : addrs[ipdom[i]];
+        g_joins[addrs[i]] = join;
+        if (join) g_joinSites.insert(join);
+    }
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+VOID ImageLoad(IMG img, VOID* v)
+{
+    BOOL instrumented = ImageMap_WantImage(img);
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec)) {
+        for (RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn)) {
+            if (g_srcRtns.count(RTN_Name(rtn))) {
+                RTN_Open(rtn);
+                RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)TaintSourceRet,
+                    IARG_REG_VALUE, g_threadReg,
+                    IARG_REG_REFERENCE, g_summaryReg,
+                    IARG_END);
+                RTN_Close(rtn);
+            }
+            if (instrumented) {
+                if (g_ctrl) FindJoins(rtn);
+                continue;
+            }
+            RTN_Open(rtn);
+            INS head = RTN_InsHead(rtn);
+            if (INS_Valid(head)) {
+                INS_InsertIfCall(head, IPOINT_BEFORE, (AFUNPTR)TaintIf_Mask, IARG_FAST_ANALYSIS_CALL,
+                    IARG_REG_VALUE, g_summaryReg,
+                    IARG_ADDRINT, (ADDRINT)TAINT_CALLER_SAVED,
+                    IARG_END);
+                INS_InsertThenCall(head, IPOINT_BEFORE, (AFUNPTR)TaintOpaqueCall,
+                    IARG_REG_VALUE, g_threadReg,
+                    IARG_REG_REFERENCE, g_summaryReg,
+                    IARG_END);
+            }
+            RTN_Close(rtn);
+        }
+    }
+}
+
+static VOID AddReg(TAINT_REG* regs, UINT32* n, TAINT_REG r, ADDRINT* mask)
+{
+    if (r.slot == TAINT_SLOT_NONE || *n == TAINT_MAX_REGS) return;
+    regs[(*n)++] = r;
+    *mask |= 1ULL << r.slot;
+}
+
+static BOOL IsClearIdiom(INS ins)
+{
+    OPCODE op = INS_Opcode(ins);
+    if (op != XED_ICLASS_XOR && op != XED_ICLASS_SUB && op != XED_ICLASS_PXOR &&
+        op != XED_ICLASS_XORPS && op != XED_ICLASS_XORPD) return FALSE;
+    return INS_OperandCount(ins) >= 2 && INS_OperandIsReg(ins, 0) && INS_OperandIsReg(ins, 1) &&
+        INS_OperandReg(ins, 0) == INS_OperandReg(ins, 1);
+}
+
+static TAINT_INS* Describe(INS ins)
+{
+    TAINT_INS* ti = new TAINT_INS();
+    ADDRINT addr = INS_Address(ins);
+    const IMAGE_INFO* img = ImageMap_Find(addr, &ti->offset);
+    string rtn = RTN_FindNameByAddress(addr);
+    ti->where = (img && !img->main) ? img->shortName + "`" + rtn : rtn;
+
+    // Registers that only form the address of a memory operand
+    REG base = REG_INVALID(), index = REG_INVALID();
+    if (!INS_IsLea(ins)) {
+        base = INS_MemoryBaseReg(ins);
+        index = INS_MemoryIndexReg(ins);
+    }
+    set<REG> explicitRead;
+    for (UINT32 op = 0; op < INS_OperandCount(ins); op++) {
+        if (INS_OperandIsReg(ins, op) && INS_OperandRead(ins, op)) explicitRead.insert(INS_OperandReg(ins, op));
+    }
+
+    for (UINT32 i = 0; i < INS_MaxNumRRegs(ins); i++) {
+        REG r = INS_RegR(ins, i);
+        if ((r == base || r == index) && !explicitRead.count(r)) {
+            if (g_addr) AddReg(ti->addr, &ti->nAddr, TaintRegOf(r), &ti->mask);
+        }
+        else {
+            AddReg(ti->src, &ti->nSrc, TaintRegOf(r), &ti->mask);
+        }
+    }
+    for (UINT32 i = 0; i < INS_MaxNumWRegs(ins); i++) {
+        AddReg(ti->dst, &ti->nDst, TaintRegOf(INS_RegW(ins, i)), &ti->mask);
+    }
+    ti->memRead = INS_IsMemoryRead(ins);
+    ti->memWrite = INS_IsMemoryWrite(ins);
+
+    XED_CATEGORY cat = (XED_CATEGORY)INS_Category(ins);
+    OPCODE op = INS_Opcode(ins);
+    ti->ctrl = !INS_IsCall(ins);
+    if (INS_IsCall(ins) || IsClearIdiom(ins)) {
+        ti->kind = TAINT_CLEAR;
+    }
+    else if ((cat == XED_CATEGORY_DATAXFER || cat == XED_CATEGORY_PUSH || cat == XED_CATEGORY_POP) &&
+             op != XED_ICLASS_XCHG && (ti->memRead ? ti->nSrc == 0 : ti->nSrc <= 1)) {
+        ti->kind = TAINT_COPY;
+        ti->signExtend = op == XED_ICLASS_MOVSX || op == XED_ICLASS_MOVSXD;
+    }
+    else {
+        ti->kind = TAINT_UNION;
+    }
+    ti->sink = img && img->main && g_sinks.count(ti->offset);
+    return ti;
+}
+
+static ADDRINT SizeMask(UINT32 size)
+{
+    return size >= 8 ? ~(ADDRINT)0 : ((ADDRINT)1 << (8 * size)) - 1;
+}
+
+// Inserts the slow path, as the Then-call of the If-call just inserted or unconditionally.
+static VOID InsertTaintIns(INS ins, TAINT_INS* ti, BOOL then)
+{
+    IARGLIST args = IARGLIST_Alloc();
+    if (ti->memRead) IARGLIST_AddArguments(args, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+    else IARGLIST_AddArguments(args, IARG_ADDRINT, (ADDRINT)0, IARG_UINT32, 0, IARG_END);
+    if (ti->memWrite) IARGLIST_AddArguments(args, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+    else IARGLIST_AddArguments(args, IARG_ADDRINT, (ADDRINT)0, IARG_UINT32, 0, IARG_END);
+
+    if (then) {
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIns,
+            IARG_REG_VALUE, g_threadReg, IARG_REG_REFERENCE, g_summaryReg, IARG_PTR, ti,
+            IARG_IARGLIST, args, IARG_REG_VALUE, REG_RSP, IARG_END);
+    }
+    else {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIns,
+            IARG_REG_VALUE, g_threadReg, IARG_REG_REFERENCE, g_summaryReg, IARG_PTR, ti,
+            IARG_IARGLIST, args, IARG_REG_VALUE, REG_RSP, IARG_END);
+    }
+    IARGLIST_Free(args);
+}
+
+VOID Instruction(INS ins, VOID* v)
+{
+    ADDRINT addr = INS_Address(ins);
+    if (!ImageMap_Instrumented(addr)) return;
+
+    // Scopes end before the post-dominator itself executes
+    if (g_ctrl && g_joinSites.count(addr)) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_InScope, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, REG_RSP, IARG_REG_VALUE, g_scopeReg, IARG_CALL_ORDER, CALL_ORDER_FIRST, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintJoin,
+            IARG_REG_VALUE, g_threadReg, IARG_REG_REFERENCE, g_scopeReg, IARG_INST_PTR, IARG_REG_VALUE, REG_RSP,
+            IARG_CALL_ORDER, CALL_ORDER_FIRST, IARG_END);
+    }
+
+    if (INS_IsRet(ins)) {
+        if (g_ctrl) {
+            // the returning frame sits above its own scopes, so any open scope is checked
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_AnyScope, IARG_FAST_ANALYSIS_CALL,
+                IARG_REG_VALUE, g_scopeReg, IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintRet,
+                IARG_REG_VALUE, g_threadReg, IARG_REG_REFERENCE, g_scopeReg, IARG_REG_VALUE, REG_RSP, IARG_END);
+        }
+        return;
+    }
+    if (INS_IsBranch(ins) && INS_HasFallThrough(ins)) {
+        unordered_map<ADDRINT, ADDRINT>::iterator it = g_joins.find(addr);
+        if (g_ctrl && it != g_joins.end()) {
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_Mask, IARG_FAST_ANALYSIS_CALL,
+                IARG_REG_VALUE, g_summaryReg, IARG_ADDRINT, (ADDRINT)(1ULL << TAINT_SLOT_FLAGS), IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintBranch,
+                IARG_REG_VALUE, g_threadReg, IARG_REG_REFERENCE, g_scopeReg, IARG_ADDRINT, it->second,
+                IARG_REG_VALUE, REG_RSP, IARG_END);
+        }
+        return;
+    }
+
+    TAINT_INS*& ti = g_taintIns[addr];
+    if (ti == 0) ti = Describe(ins);
+    if (ti->nDst == 0 && !ti->memWrite) return;
+
+    // Operands wider than 8 bytes (SSE copies, rep movs) always take the slow path
+    UINT32 readSize = 0, writeSize = 0, memOps = INS_MemoryOperandCount(ins);
+    for (UINT32 op = 0; op < memOps; op++) {
+        if (INS_MemoryOperandIsRead(ins, op)) readSize = max<UINT32>(readSize, INS_MemoryOperandSize(ins, op));
+        if (INS_MemoryOperandIsWritten(ins, op)) writeSize = max<UINT32>(writeSize, INS_MemoryOperandSize(ins, op));
+    }
+    if (ti->sink || readSize > 8 || writeSize > 8 || INS_RepPrefix(ins)) {
+        InsertTaintIns(ins, ti, FALSE);
+        return;
+    }
+
+    if (ti->memRead && ti->memWrite && memOps > 1) {
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_MM, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_summaryReg, IARG_ADDRINT, ti->mask, IARG_REG_VALUE, REG_RSP, IARG_REG_VALUE, g_scopeReg,
+            IARG_MEMORYREAD_EA, IARG_ADDRINT, SizeMask(readSize),
+            IARG_MEMORYWRITE_EA, IARG_ADDRINT, SizeMask(writeSize), IARG_END);
+    }
+    else if (ti->memRead || ti->memWrite) {
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_M, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_summaryReg, IARG_ADDRINT, ti->mask, IARG_REG_VALUE, REG_RSP, IARG_REG_VALUE, g_scopeReg,
+            ti->memRead ? IARG_MEMORYREAD_EA : IARG_MEMORYWRITE_EA, IARG_ADDRINT, SizeMask(max(readSize, writeSize)), IARG_END);
+    }
+    else {
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)TaintIf_R, IARG_FAST_ANALYSIS_CALL,
+            IARG_REG_VALUE, g_summaryReg, IARG_ADDRINT, ti->mask, IARG_REG_VALUE, REG_RSP, IARG_REG_VALUE, g_scopeReg,
+            IARG_END);
+    }
+    InsertTaintIns(ins, ti, TRUE);
+}
+
+/* ===================================================================== */
+/* Report */
+/* ===================================================================== */
+
+static string LabelName(UINT8 labels)
+{
+    string s;
+    if (labels & TAINT_GETCH) s += "getch|";
+    if (labels & TAINT_READ) s += "read|";
+    if (labels & TAINT_CTRL) s += "ctrl|";
+    if (!s.empty()) s.erase(s.size() - 1);
+    return s;
+}
+
+bool CompareTainted(const TAINT_INS* a, const TAINT_INS* b) { return a->tainted > b->tainted; }
+
+static VOID ReportSite(FILE* fp, const TAINT_INS* ti)
+{
+    fprintf(fp, "%lx (%s), stores: %llu, tainted: %llu, via branch: %llu, labels: %s\n", ti->offset, ti->where.c_str(),
+        (unsigned long long)ti->stores, (unsigned long long)ti->tainted, (unsigned long long)ti->viaCtrl,
+        LabelName(ti->labels).c_str());
+}
+
+VOID Fini(INT32 code, VOID* v)
+{
+    FILE* fp = g_fpOut;
+
+    UINT64 bytes = 0;
+    for (size_t i = 0; i < g_taintChunks.size(); i++) {
+        for (size_t b = 0; b < TAINT_CHUNK_SIZE; b++) bytes += g_taintChunks[i][b] != 0;
+    }
+    fprintf(fp, "[SOURCES] %llu input routine returns, %llu bytes read\n",
+        (unsigned long long)g_getchCalls, (unsigned long long)g_readBytes);
+    fprintf(fp, "[SHADOW] %llu chunks of 1 MB, %llu bytes tainted at exit, %llu scopes from tainted branches\n",
+        (unsigned long long)g_taintChunks.size(), (unsigned long long)bytes, (unsigned long long)g_branches);
+
+    vector<TAINT_INS*> sites;
+    fprintf(fp, "\n[SINKS] offset (routine), stores, tainted, via branch, labels\n");
+    for (unordered_map<ADDRINT, TAINT_INS*>::iterator it = g_taintIns.begin(); it != g_taintIns.end(); ++it) {
+        if (it->second->sink) ReportSite(fp, it->second);
+        if (it->second->memWrite && it->second->tainted) sites.push_back(it->second);
+    }
+
+    size_t n = KnobTop.Value() ? min<size_t>(KnobTop.Value(), sites.size()) : sites.size();
+    partial_sort(sites.begin(), sites.begin() + n, sites.end(), CompareTainted);
+    fprintf(fp, "\n[STORES] top %lu of %lu store sites that wrote input-dependent bytes\n", (unsigned long)n, (unsigned long)sites.size());
+    fprintf(fp, "# offset (routine), stores on the slow path, tainted, via branch, labels\n");
+    for (size_t i = 0; i < n; i++) ReportSite(fp, sites[i]);
+    fclose(fp);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+static VOID SplitList(const string& text, vector<string>& items)
+{
+    for (size_t start = 0; start < text.size(); ) {
+        size_t comma = text.find(',', start);
+        if (comma == string::npos) comma = text.size();
+        if (comma > start) items.push_back(text.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
+
+// Parses -taint_rtn, -taint_fds and -taint_sink. FALSE on a malformed list.
+static BOOL Taint_Init()
+{
+    vector<string> items;
+    SplitList(KnobTaintRtn.Value(), items);
+    g_srcRtns.insert(items.begin(), items.end());
+
+    items.clear();
+    SplitList(KnobTaintFds.Value(), items);
+    for (size_t i = 0; i < items.size(); i++) {
+        char* end;
+        if (items[i] == "all") g_allFds = TRUE;
+        else g_srcFds.insert(strtol(items[i].c_str(), &end, 10));
+        if (items[i] != "all" && *end != '\0') {
+            fprintf(stderr, "[TAINT] bad -taint_fds %s\n", KnobTaintFds.Value().c_str());
+            return FALSE;
+        }
+    }
+
+    items.clear();
+    SplitList(KnobTaintSink.Value(), items);
+    for (size_t i = 0; i < items.size(); i++) {
+        char* end;
+        g_sinks.insert(strtoul(items[i].c_str(), &end, 16));
+        if (*end != '\0') {
+            fprintf(stderr, "[TAINT] bad -taint_sink %s\n", KnobTaintSink.Value().c_str());
+            return FALSE;
+        }
+    }
+
+    g_threadReg = PIN_ClaimToolRegister();
+    g_summaryReg = PIN_ClaimToolRegister();
+    g_scopeReg = PIN_ClaimToolRegister();
+    if (!REG_valid(g_threadReg) || !REG_valid(g_summaryReg) || !REG_valid(g_scopeReg)) {
+        fprintf(stderr, "[TAINT] no tool register available\n");
+        return FALSE;
+    }
+
+    // 1 GB of address space; only the pages of the top table that are written get memory
+    g_taintTop = (UINT8**)mmap(0, TAINT_TOP_ENTRIES * sizeof(UINT8*), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (g_taintTop == MAP_FAILED) {
+        fprintf(stderr, "[TAINT] cannot map the shadow table\n");
+        return FALSE;
+    }
+    g_ctrl = KnobTaintCtrl.Value();
+    g_addr = KnobTaintAddr.Value();
+    PIN_InitLock(&g_taintLock);
+    return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+    if (!Replay_Init() || !Taint_Init())
+    {
+        return Usage();
+    }
+
+    g_fpOut = fopen(KnobOutput.Value().c_str(), "wt");
+
+    ImageMap_Init();
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddSyscallEntryFunction(SyscallEntry, 0);
+    PIN_AddSyscallExitFunction(SyscallExit, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
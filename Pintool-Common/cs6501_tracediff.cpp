@@ -0,0 +1,404 @@
+/*! @file
+ *  Differential analyzer for two binary traces (cs6501_binlog.h) of the same game:
+ *  one session that ends in the outcome (a collision) and one that does not.
+ *
+ *      pin -t cs6501_homework3.so -record crash.rr -binlog_file crash.bin -- ./flappybird
+ *      pin -t cs6501_homework3.so -record safe.rr  -binlog_file safe.bin  -- ./flappybird
+ *      ./cs6501_tracediff crash.bin safe.bin
+ *
+ *  (-replay crash.rr reproduces a trace exactly once the sessions are recorded.)
+ *
+ *  The traces are aligned store by store on (thread, write site offset, n-th
+ *  execution of that site), so code that runs in only one of them does not shift
+ *  everything after it. Both files are streamed in step and each keeps at most
+ *  -window unmatched stores waiting for a partner: one more evicts the oldest,
+ *  which is counted as "only in" its run, so memory stays bounded whatever the
+ *  length of the sessions. How long a store waits depends on how many others are
+ *  unmatched at the time, not on a fixed record distance.
+ *
+ *  The outcome is at the end of the traces: store sites and memory locations are
+ *  ranked by how close to the end (within the last -tail records) their values
+ *  last differed, then by how often; sites that differ before the tail as well
+ *  (counters, timers) are marked with * and go last. Sites that only run in one of
+ *  the two traces near the end (the collision handling itself) are listed separately.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cs6501_binlog_format.h"
+
+using namespace std;
+
+// Alignment key: the n-th execution of a write site in one thread.
+struct STORE_KEY {
+    uint64_t offset;
+    uint64_t occurrence;
+    uint32_t tid;
+    uint8_t kind, label;
+
+    bool operator==(const STORE_KEY& o) const
+    {
+        return offset == o.offset && occurrence == o.occurrence && tid == o.tid && kind == o.kind && label == o.label;
+    }
+};
+
+struct STORE_KEY_HASH {
+    size_t operator()(const STORE_KEY& k) const
+    {
+        uint64_t h = k.offset * 0x9e3779b97f4a7c15ULL ^ k.occurrence * 0xc2b2ae3d27d4eb4fULL;
+        return h ^ (((uint64_t)k.tid << 16 | k.kind << 8 | k.label) * 0x165667b19e3779f9ULL);
+    }
+};
+
+// A store still waiting for its partner in the other trace.
+struct PENDING {
+    uint64_t pos;           // record number in its trace
+    uint64_t addr;
+    uint16_t size;
+    uint8_t data[BINLOG_DATA_MAX];
+    uint64_t order;         // key in the eviction order
+};
+
+// One trace being streamed.
+struct TRACE {
+    const char* path;
+    FILE* fp;
+    uint64_t records;       // in the file
+    uint64_t pos;           // records read so far
+    bool done;
+    char labels[256][BINLOG_LABEL_MAX];
+    unordered_map<STORE_KEY, uint64_t, STORE_KEY_HASH> executions;  // per site, key.occurrence == 0
+    unordered_map<STORE_KEY, PENDING, STORE_KEY_HASH> pending;
+    map<uint64_t, STORE_KEY> order;                                 // oldest pending first
+};
+
+// Per write site (kind, label, offset).
+struct SITE_DIFF {
+    uint64_t matched, differing;
+    uint64_t only[2];               // stores whose partner never came
+    uint64_t onlyTail[2];
+    uint64_t tailDiffs;             // differing stores in the tail
+    uint64_t lastDiff;              // records before the end of trace A, if tailDiffs
+    uint16_t size;
+    uint8_t lastA[BINLOG_DATA_MAX], lastB[BINLOG_DATA_MAX];
+};
+
+// Per memory location written with different values in the tail.
+struct LOC_DIFF {
+    uint64_t site, addrB;
+    uint64_t differing;
+    uint64_t lastDiff;
+    uint16_t size;
+    uint8_t lastA[BINLOG_DATA_MAX], lastB[BINLOG_DATA_MAX];
+};
+
+static TRACE g_trace[2];
+static uint64_t g_window = 1 << 18;
+static uint64_t g_tail = 1 << 17;
+static size_t g_maxLocs = 1 << 20;
+static unsigned g_top = 20;
+static uint64_t g_orderNo = 0;
+static unordered_map<uint64_t, SITE_DIFF> g_sites;  // by SiteId()
+static unordered_map<uint64_t, LOC_DIFF> g_locs;    // by address in trace A
+static uint64_t g_matched = 0, g_differing = 0, g_locsDropped = 0;
+
+static uint64_t SiteId(const STORE_KEY& k) { return k.offset | (uint64_t)k.kind << 56 | (uint64_t)k.label << 48; }
+
+static string SiteName(uint64_t id)
+{
+    char buf[64];
+    uint8_t kind = id >> 56, label = id >> 48;
+    uint64_t offset = id & ((1ULL << 48) - 1);
+    if (kind == BINLOG_KIND_MEMWRITE_NAMED) snprintf(buf, sizeof(buf), "%lx (%s)", (unsigned long)offset, g_trace[0].labels[label]);
+    else snprintf(buf, sizeof(buf), "%lx", (unsigned long)offset);
+    return buf;
+}
+
+// Same rendering as LogData() in the Pin tools.
+static string Value(const uint8_t* data, uint16_t size)
+{
+    char buf[64];
+    if (size == 4) {
+        int32_t v;
+        memcpy(&v, data, 4);
+        snprintf(buf, sizeof(buf), "%d", v);
+    }
+    else if (size == 8) {
+        long long v;
+        memcpy(&v, data, 8);
+        snprintf(buf, sizeof(buf), "%lld", v);
+    }
+    else {
+        string s;
+        for (unsigned i = 0; i < size && i < 8; i++) {
+            snprintf(buf, sizeof(buf), "%02x", data[i]);
+            s += buf;
+        }
+        return size > 8 ? s + ".." : s;
+    }
+    return buf;
+}
+
+static bool OpenTrace(TRACE& t, const char* path)
+{
+    t.path = path;
+    t.pos = 0;
+    t.done = false;
+    memset(t.labels, 0, sizeof(t.labels));
+    t.fp = fopen(path, "rb");
+    if (t.fp == 0) {
+        perror(path);
+        return false;
+    }
+
+    BINLOG_FILE_HEADER hdr;
+    if (fread(&hdr, sizeof(hdr), 1, t.fp) != 1 || memcmp(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "%s: not a cs6501 binary trace\n", path);
+        return false;
+    }
+    if (hdr.version != BINLOG_VERSION || hdr.recordSize != sizeof(BINLOG_RECORD)) {
+        fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n", path, hdr.version, hdr.recordSize);
+        return false;
+    }
+    struct stat st;
+    fstat(fileno(t.fp), &st);
+    t.records = (st.st_size - sizeof(hdr)) / sizeof(BINLOG_RECORD);
+    return true;
+}
+
+// Records before the end of its trace.
+static uint64_t FromEnd(int side, uint64_t pos) { return g_trace[side].records - 1 - pos; }
+
+static void Compare(const STORE_KEY& key, const PENDING& a, const PENDING& b)
+{
+    SITE_DIFF& s = g_sites[SiteId(key)];
+    s.matched++;
+    g_matched++;
+    uint16_t n = min<uint16_t>(min(a.size, b.size), BINLOG_DATA_MAX);
+    if (a.size == b.size && memcmp(a.data, b.data, n) == 0) return;
+
+    s.differing++;
+    g_differing++;
+    uint64_t end = FromEnd(0, a.pos);
+    if (end >= g_tail) return;
+    if (s.tailDiffs++ == 0 || end <= s.lastDiff) {
+        s.lastDiff = end;
+        s.size = a.size;
+        memcpy(s.lastA, a.data, BINLOG_DATA_MAX);
+        memcpy(s.lastB, b.data, BINLOG_DATA_MAX);
+    }
+
+    unordered_map<uint64_t, LOC_DIFF>::iterator it = g_locs.find(a.addr);
+    if (it == g_locs.end()) {
+        if (g_locs.size() >= g_maxLocs) {
+            g_locsDropped++;
+            return;
+        }
+        it = g_locs.insert(make_pair(a.addr, LOC_DIFF())).first;
+        it->second.differing = 0;
+        it->second.lastDiff = ~0ULL;
+    }
+    LOC_DIFF& l = it->second;
+    l.differing++;
+    if (end <= l.lastDiff) {
+        l.lastDiff = end;
+        l.site = SiteId(key);
+        l.addrB = b.addr;
+        l.size = a.size;
+        memcpy(l.lastA, a.data, BINLOG_DATA_MAX);
+        memcpy(l.lastB, b.data, BINLOG_DATA_MAX);
+    }
+}
+
+static void CountOnly(int side, const STORE_KEY& key, const PENDING& p)
+{
+    SITE_DIFF& s = g_sites[SiteId(key)];
+    s.only[side]++;
+    if (FromEnd(side, p.pos) < g_tail) s.onlyTail[side]++;
+}
+
+// Reads one store of trace 'side' and matches it against the other trace.
+static void Step(int side)
+{
+    TRACE& t = g_trace[side];
+    TRACE& other = g_trace[1 - side];
+    BINLOG_RECORD rec;
+
+    for (;;) {
+        if (fread(&rec, sizeof(rec), 1, t.fp) != 1) {
+            t.done = true;
+            return;
+        }
+        t.pos++;
+        if (rec.kind == BINLOG_KIND_LABEL) {
+            memcpy(t.labels[rec.label], rec.data, BINLOG_LABEL_MAX);
+            t.labels[rec.label][BINLOG_LABEL_MAX - 1] = 0;
+            continue;
+        }
+        break;
+    }
+
+    STORE_KEY key;
+    key.offset = rec.offset;
+    key.tid = rec.tid;
+    key.kind = rec.kind;
+    key.label = rec.label;
+    key.occurrence = 0;
+    key.occurrence = ++t.executions[key];
+
+    PENDING p;
+    p.pos = t.pos - 1;
+    p.addr = rec.addr;
+    p.size = rec.size;
+    memcpy(p.data, rec.data, BINLOG_DATA_MAX);
+
+    unordered_map<STORE_KEY, PENDING, STORE_KEY_HASH>::iterator it = other.pending.find(key);
+    if (it != other.pending.end()) {
+        if (side == 0) Compare(key, p, it->second);
+        else Compare(key, it->second, p);
+        other.order.erase(it->second.order);
+        other.pending.erase(it);
+        return;
+    }
+
+    p.order = g_orderNo++;
+    t.pending[key] = p;
+    t.order[p.order] = key;
+    if (t.pending.size() > g_window) {
+        // Too many unmatched stores: the oldest one only happens in this run
+        const STORE_KEY& oldest = t.order.begin()->second;
+        CountOnly(side, oldest, t.pending[oldest]);
+        t.pending.erase(oldest);
+        t.order.erase(t.order.begin());
+    }
+}
+
+/* ===================================================================== */
+/* Report */
+/* ===================================================================== */
+
+// A site that also differs before the tail (a frame counter, a timer) diverged
+// from the start and says nothing about the outcome; it ranks after the others.
+static bool Steady(uint64_t site)
+{
+    const SITE_DIFF& s = g_sites[site];
+    return s.differing != s.tailDiffs;
+}
+
+static bool BySiteDiff(const pair<uint64_t, SITE_DIFF>& a, const pair<uint64_t, SITE_DIFF>& b)
+{
+    bool sa = Steady(a.first), sb = Steady(b.first);
+    if (sa != sb) return sb;
+    if (a.second.lastDiff != b.second.lastDiff) return a.second.lastDiff < b.second.lastDiff;
+    return a.second.differing > b.second.differing;
+}
+
+static bool ByLocDiff(const pair<uint64_t, LOC_DIFF>& a, const pair<uint64_t, LOC_DIFF>& b)
+{
+    bool sa = Steady(a.second.site), sb = Steady(b.second.site);
+    if (sa != sb) return sb;
+    if (a.second.lastDiff != b.second.lastDiff) return a.second.lastDiff < b.second.lastDiff;
+    return a.second.differing > b.second.differing;
+}
+
+static bool ByOnlyTail0(const pair<uint64_t, SITE_DIFF>& a, const pair<uint64_t, SITE_DIFF>& b) { return a.second.onlyTail[0] > b.second.onlyTail[0]; }
+static bool ByOnlyTail1(const pair<uint64_t, SITE_DIFF>& a, const pair<uint64_t, SITE_DIFF>& b) { return a.second.onlyTail[1] > b.second.onlyTail[1]; }
+
+static void Report()
+{
+    printf("# A: %s (%llu records), B: %s (%llu records)\n", g_trace[0].path, (unsigned long long)g_trace[0].records,
+        g_trace[1].path, (unsigned long long)g_trace[1].records);
+    printf("# %llu stores aligned, %llu with different values; tail: last %llu records\n",
+        (unsigned long long)g_matched, (unsigned long long)g_differing, (unsigned long long)g_tail);
+    if (g_locsDropped) printf("# %llu differences at new locations dropped (-max_locs)\n", (unsigned long long)g_locsDropped);
+
+    vector<pair<uint64_t, SITE_DIFF> > sites;
+    for (unordered_map<uint64_t, SITE_DIFF>::iterator it = g_sites.begin(); it != g_sites.end(); ++it) {
+        if (it->second.tailDiffs) sites.push_back(*it);
+    }
+    sort(sites.begin(), sites.end(), BySiteDiff);
+    printf("\n[SITES] store sites by last difference before the end of A, steady ones (*) last\n");
+    printf("# offset, records before end, differing / aligned, last value A -> B\n");
+    for (size_t i = 0; i < sites.size() && i < g_top; i++) {
+        const SITE_DIFF& s = sites[i].second;
+        printf("%s%s, %llu, %llu / %llu, %s -> %s\n", SiteName(sites[i].first).c_str(), Steady(sites[i].first) ? "*" : "",
+            (unsigned long long)s.lastDiff,
+            (unsigned long long)s.differing, (unsigned long long)s.matched,
+            Value(s.lastA, s.size).c_str(), Value(s.lastB, s.size).c_str());
+    }
+
+    vector<pair<uint64_t, LOC_DIFF> > locs(g_locs.begin(), g_locs.end());
+    sort(locs.begin(), locs.end(), ByLocDiff);
+    printf("\n[LOCATIONS] memory locations by last difference before the end of A, steady sites (*) last\n");
+    printf("# address (in B), records before end, differing stores, last site, last value A -> B\n");
+    for (size_t i = 0; i < locs.size() && i < g_top; i++) {
+        const LOC_DIFF& l = locs[i].second;
+        printf("%lx", (unsigned long)locs[i].first);
+        if (l.addrB != locs[i].first) printf(" (%lx)", (unsigned long)l.addrB);
+        printf(", %llu, %llu, %s%s, %s -> %s\n", (unsigned long long)l.lastDiff, (unsigned long long)l.differing,
+            SiteName(l.site).c_str(), Steady(l.site) ? "*" : "", Value(l.lastA, l.size).c_str(), Value(l.lastB, l.size).c_str());
+    }
+
+    for (int side = 0; side < 2; side++) {
+        vector<pair<uint64_t, SITE_DIFF> > only;
+        for (unordered_map<uint64_t, SITE_DIFF>::iterator it = g_sites.begin(); it != g_sites.end(); ++it) {
+            if (it->second.onlyTail[side]) only.push_back(*it);
+        }
+        sort(only.begin(), only.end(), side ? ByOnlyTail1 : ByOnlyTail0);
+        printf("\n[ONLY-%c] store sites that run only in %s near its end\n", side ? 'B' : 'A', g_trace[side].path);
+        printf("# offset, stores in the tail, stores in total\n");
+        for (size_t i = 0; i < only.size() && i < g_top; i++) {
+            printf("%s, %llu, %llu\n", SiteName(only[i].first).c_str(),
+                (unsigned long long)only[i].second.onlyTail[side], (unsigned long long)only[i].second.only[side]);
+        }
+    }
+}
+
+static int Usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-window N] [-tail N] [-top N] [-max_locs N] outcome.bin other.bin\n", argv0);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int i;
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        uint64_t v = strtoull(argv[i + 1], 0, 0);
+        if (strcmp(argv[i], "-window") == 0) g_window = v;
+        else if (strcmp(argv[i], "-tail") == 0) g_tail = v;
+        else if (strcmp(argv[i], "-top") == 0) g_top = v;
+        else if (strcmp(argv[i], "-max_locs") == 0) g_maxLocs = v;
+        else return Usage(argv[0]);
+    }
+    if (argc - i != 2 || g_window == 0) return Usage(argv[0]);
+    if (!OpenTrace(g_trace[0], argv[i]) || !OpenTrace(g_trace[1], argv[i + 1])) return 1;
+
+    // Keep both files at the same relative position, so partners meet within the window
+    while (!g_trace[0].done || !g_trace[1].done) {
+        int side;
+        if (g_trace[0].done) side = 1;
+        else if (g_trace[1].done) side = 0;
+        else side = (double)g_trace[0].pos / (g_trace[0].records + 1) <= (double)g_trace[1].pos / (g_trace[1].records + 1) ? 0 : 1;
+        Step(side);
+    }
+
+    // What is still waiting never found a partner
+    for (int side = 0; side < 2; side++) {
+        TRACE& t = g_trace[side];
+        for (map<uint64_t, STORE_KEY>::iterator it = t.order.begin(); it != t.order.end(); ++it) {
+            CountOnly(side, it->second, t.pending[it->second]);
+        }
+        fclose(t.fp);
+    }
+
+    Report();
+    return 0;
+}
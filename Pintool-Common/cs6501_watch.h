@@ -0,0 +1,354 @@
+/*! @file
+ *  Watchpoint engine for the cs6501 Pin tools.
+ *
+ *  Watches are read from a spec file, one per line ('#' starts a comment):
+ *
+ *      <location>  <size>  log                 log every store to the watch
+ *      <location>  <size>  zero                zero the watch after every store
+ *      <location>  <size>  clamp <lo> <hi>     clamp the (signed) value into [lo, hi]
+ *      <location>  <size>  freeze <value>      write <value> back after every store
+ *
+ *  clamp and freeze take a size of 1, 2, 4 or 8 bytes.
+ *
+ *  A location is an absolute address (0x7fffffffd824) or a data symbol with an
+ *  optional offset (g_s_collision, meteor_table+0xc).
+ *
+ *  Watched bytes are marked in a two-level shadow bitmap: a directory of 16 MB
+ *  regions (mmap'ed, only touched pages are backed) pointing to one bit per byte.
+ *  Every store is checked by an inlinable If-routine with two loads and no
+ *  branches, so the cost is the same for 1 or 10,000 watches.
+ */
+
+#ifndef CS6501_WATCH_H
+#define CS6501_WATCH_H
+
+#include "pin.H"
+#include <sys/mman.h>
+#include <map>
+#include <vector>
+#include "cs6501_binlog.h"
+#include "cs6501_patchspec.h"
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<std::string> KnobWatchFile(KNOB_MODE_WRITEONCE, "pintool", "watch", "",
+    "watchpoint spec file (see cs6501_watch.h), empty for none");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+enum WATCH_ACTION {
+    WATCH_LOG,
+    WATCH_ZERO,
+    WATCH_CLAMP,
+    WATCH_FREEZE,
+};
+
+struct WATCH {
+    std::string name;       // location as written in the spec
+    PATCH_LOC loc;
+    ADDRINT addr;           // 0 until the symbol is resolved
+    UINT32 size;
+    WATCH_ACTION action;
+    INT64 lo, hi;           // WATCH_CLAMP
+    INT64 value;            // WATCH_FREEZE
+    UINT8 label;            // binary trace label
+    UINT64 hits;
+    int line;
+};
+
+#define WATCH_REGION_SHIFT  24                              // one bitmap per 16 MB
+#define WATCH_REGION_BYTES  ((ADDRINT)1 << WATCH_REGION_SHIFT)
+#define WATCH_DIR_ENTRIES   ((ADDRINT)1 << (47 - WATCH_REGION_SHIFT))   // 47-bit user space
+#define WATCH_LEAF_BYTES    (WATCH_REGION_BYTES / 8 + 8)    // +8: first 64 bits of the next region
+
+// Directory entries hold the distance from g_watchZeroLeaf, so an untouched
+// (zero) entry points at an all-zero bitmap and the check needs no branch.
+static ADDRDELTA* g_watchDir = 0;
+static UINT8* g_watchZeroLeaf = 0;
+static std::vector<WATCH*> g_watches;
+static std::map<ADDRINT, WATCH*> g_watchByAddr;    // resolved watches by start address
+static FILE* g_fpWatchLog = 0;
+
+/* ===================================================================== */
+
+static UINT8* Watch_Leaf(ADDRINT addr)
+{
+    ADDRDELTA& entry = g_watchDir[(addr >> WATCH_REGION_SHIFT) & (WATCH_DIR_ENTRIES - 1)];
+    if (entry == 0) {
+        entry = new UINT8[WATCH_LEAF_BYTES]() - g_watchZeroLeaf;
+    }
+    return g_watchZeroLeaf + entry;
+}
+
+static VOID Watch_MarkByte(ADDRINT a)
+{
+    ADDRINT off = a & (WATCH_REGION_BYTES - 1);
+    Watch_Leaf(a)[off >> 3] |= 1 << (off & 7);
+
+    // Mirror the first 64 bits into the tail of the previous region's bitmap,
+    // so a store straddling the region boundary is still caught by one load.
+    if (off < 64 && a >= WATCH_REGION_BYTES) {
+        ADDRINT tail = WATCH_REGION_BYTES + off;
+        Watch_Leaf(a - WATCH_REGION_BYTES)[tail >> 3] |= 1 << (tail & 7);
+    }
+}
+
+static BOOL Watch_Resolve(WATCH* w, ADDRINT addr)
+{
+    std::map<ADDRINT, WATCH*>::iterator it = g_watchByAddr.lower_bound(addr);
+    BOOL overlaps = it != g_watchByAddr.end() && it->first < addr + w->size;
+    if (!overlaps && it != g_watchByAddr.begin()) {
+        --it;
+        overlaps = it->first + it->second->size > addr;
+    }
+    if (overlaps) {
+        fprintf(stderr, "[WATCH] line %d: %s overlaps %s, skipped\n", w->line, w->name.c_str(), it->second->name.c_str());
+        return FALSE;
+    }
+    w->addr = addr;
+    g_watchByAddr[addr] = w;
+    for (ADDRINT a = addr; a < addr + w->size; a++) {
+        Watch_MarkByte(a);
+    }
+    return TRUE;
+}
+
+static BOOL Watch_Load(const char* path)
+{
+    FILE* fp = fopen(path, "rt");
+    if (fp == 0) {
+        fprintf(stderr, "[WATCH] cannot open %s\n", path);
+        return FALSE;
+    }
+
+    BOOL ok = TRUE;
+    char line[512];
+    for (int lineNo = 1; fgets(line, sizeof(line), fp); lineNo++) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = 0;
+
+        char* tok[5];
+        int n = 0;
+        for (char* t = strtok(line, " \t\r\n"); t && n < 5; t = strtok(0, " \t\r\n")) {
+            tok[n++] = t;
+        }
+        if (n == 0) continue;
+
+        WATCH* w = new WATCH;
+        uint64_t size = 0, a = 0, b = 0;
+        w->name = n ? tok[0] : "";
+        w->addr = 0;
+        w->lo = w->hi = w->value = 0;
+        w->hits = 0;
+        w->line = lineNo;
+        // clamp / freeze treat the variable as a 1, 2, 4 or 8-byte integer
+        BOOL isInt = size == 1 || size == 2 || size == 4 || size == 8;
+        BOOL good = n >= 3 && PatchSpec_ParseLoc(tok[0], &w->loc) && PatchSpec_ParseNumber(tok[1], &size) && size > 0;
+        if (good && strcmp(tok[2], "log") == 0 && n == 3) {
+            w->action = WATCH_LOG;
+        }
+        else if (good && strcmp(tok[2], "zero") == 0 && n == 3) {
+            w->action = WATCH_ZERO;
+        }
+        else if (good && strcmp(tok[2], "clamp") == 0 && n == 5 && isInt) {
+            w->action = WATCH_CLAMP;
+            good = PatchSpec_ParseNumber(tok[3], &a) && PatchSpec_ParseNumber(tok[4], &b);
+            w->lo = (INT64)a;
+            w->hi = (INT64)b;
+        }
+        else if (good && strcmp(tok[2], "freeze") == 0 && n == 4 && isInt) {
+            w->action = WATCH_FREEZE;
+            good = PatchSpec_ParseNumber(tok[3], &a);
+            w->value = (INT64)a;
+        }
+        else {
+            good = FALSE;
+        }
+
+        if (!good) {
+            fprintf(stderr, "[WATCH] %s:%d: cannot parse watch\n", path, lineNo);
+            delete w;
+            ok = FALSE;
+            continue;
+        }
+        w->size = (UINT32)size;
+        g_watches.push_back(w);
+        if (w->loc.symbol.empty()) {
+            Watch_Resolve(w, w->loc.offset);
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+static INT64 Watch_ReadInt(ADDRINT addr, UINT32 size)
+{
+    switch (size) {
+    case 1: return *(INT8*)addr;
+    case 2: return *(INT16*)addr;
+    case 4: return *(INT32*)addr;
+    default: return *(INT64*)addr;     // 8, the only other size Watch_Load accepts
+    }
+}
+
+static VOID Watch_Log(THREADID tid, WATCH* w, ADDRINT offset, ADDRINT addr, UINT32 size)
+{
+    if (BinLog_Enabled()) {
+        BinLog_MemWriteNamed(tid, w->label, offset, (VOID*)addr, size);
+        return;
+    }
+    fprintf(g_fpWatchLog, "[MEMWRITE] %s %p mem: %p (sz: %d) -> ", w->name.c_str(), (VOID*)offset, (VOID*)addr, size);
+    switch (size) {
+    case 4:
+        fprintf(g_fpWatchLog, "%d\n", *(INT32*)addr);
+        break;
+    case 8:
+        fprintf(g_fpWatchLog, "%lld\n", (long long)*(INT64*)addr);
+        break;
+    default:
+        for (UINT32 i = 0; i < size; i++) {
+            fprintf(g_fpWatchLog, "%02x ", ((UINT8*)addr)[i]);
+        }
+        fprintf(g_fpWatchLog, "\n");
+        break;
+    }
+}
+
+/* ===================================================================== */
+/* Analysis Routines */
+/* ===================================================================== */
+
+// If-routine: does the store [addr, addr+size) touch a watched byte?
+// (Stores wider than 57 bytes, FXSAVE/XSAVE and rep movs, are only checked on
+// their first 57 bytes.)
+ADDRINT PIN_FAST_ANALYSIS_CALL Watch_IsHit(ADDRINT addr, UINT32 size)
+{
+    size = size > 57 ? 57 : size;
+    const UINT8* leaf = g_watchZeroLeaf + g_watchDir[(addr >> WATCH_REGION_SHIFT) & (WATCH_DIR_ENTRIES - 1)];
+    ADDRINT off = addr & (WATCH_REGION_BYTES - 1);
+    UINT64 bits;
+    memcpy(&bits, leaf + (off >> 3), sizeof(bits));
+    return (bits >> (off & 7)) & ((2ULL << (size - 1)) - 1);
+}
+
+// Then-routine: applies the action of every watch the store touched.
+VOID Watch_OnWrite(THREADID tid, ADDRINT offset, ADDRINT addr, UINT32 size)
+{
+    std::map<ADDRINT, WATCH*>::iterator it = g_watchByAddr.upper_bound(addr);
+    if (it != g_watchByAddr.begin()) --it;
+
+    for (; it != g_watchByAddr.end() && it->first < addr + size; ++it) {
+        WATCH* w = it->second;
+        if (w->addr + w->size <= addr) continue;
+
+        w->hits++;
+        Watch_Log(tid, w, offset, addr, size);
+        switch (w->action) {
+        case WATCH_LOG:
+            break;
+        case WATCH_ZERO:
+            memset((VOID*)w->addr, 0, w->size);
+            break;
+        case WATCH_CLAMP:
+            {
+                INT64 v = Watch_ReadInt(w->addr, w->size);
+                v = v < w->lo ? w->lo : (v > w->hi ? w->hi : v);
+                memcpy((VOID*)w->addr, &v, w->size);   // little endian: low bytes first
+            }
+            break;
+        case WATCH_FREEZE:
+            memcpy((VOID*)w->addr, &w->value, w->size);
+            break;
+        }
+    }
+}
+
+/* ===================================================================== */
+/* Interface */
+/* ===================================================================== */
+
+inline BOOL Watch_Enabled() { return !g_watches.empty(); }
+
+// Call from main() after PIN_Init and BinLog_Init. Text records go to fpLog.
+BOOL Watch_Init(FILE* fpLog)
+{
+    g_fpWatchLog = fpLog;
+    if (KnobWatchFile.Value().empty()) return TRUE;
+
+    VOID* dir = mmap(0, WATCH_DIR_ENTRIES * sizeof(ADDRDELTA), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (dir == MAP_FAILED) {
+        fprintf(stderr, "[WATCH] cannot reserve the shadow directory\n");
+        return FALSE;
+    }
+    g_watchDir = (ADDRDELTA*)dir;
+    g_watchZeroLeaf = new UINT8[WATCH_LEAF_BYTES]();
+
+    BOOL ok = Watch_Load(KnobWatchFile.Value().c_str());
+    UINT8 shared = 0;
+    for (size_t i = 0; i < g_watches.size(); i++) {
+        // Label ids are 8 bit: past 255 watches the rest share one "watch" label.
+        if (i < 255) g_watches[i]->label = BinLog_DefineLabel(g_watches[i]->name.c_str());
+        else {
+            if (i == 255) shared = BinLog_DefineLabel("watch");
+            g_watches[i]->label = shared;
+        }
+    }
+    return ok;
+}
+
+// Call from ImageLoad(): resolves the symbol watches defined in img.
+VOID Watch_ImageLoad(IMG img)
+{
+    for (size_t i = 0; i < g_watches.size(); i++) {
+        WATCH* w = g_watches[i];
+        if (w->addr || w->loc.symbol.empty()) continue;
+
+        for (SYM sym = IMG_RegsymHead(img); SYM_Valid(sym); sym = SYM_Next(sym)) {
+            if (SYM_Name(sym) == w->loc.symbol) {
+                if (Watch_Resolve(w, SYM_Address(sym) + w->loc.offset)) {
+                    fprintf(g_fpWatchLog, "[WATCH] %s -> %lx\n", w->name.c_str(), w->addr);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Call from Instruction() for a store; offset is the image offset logged with hits.
+VOID Watch_InstrumentIns(INS ins, ADDRINT offset)
+{
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (!INS_MemoryOperandIsWritten(ins, memOp)) continue;
+
+        INS_InsertIfCall(
+            ins, IPOINT_AFTER, (AFUNPTR)Watch_IsHit, IARG_FAST_ANALYSIS_CALL,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_MEMORYWRITE_SIZE,
+            IARG_END);
+        INS_InsertThenCall(
+            ins, IPOINT_AFTER, (AFUNPTR)Watch_OnWrite,
+            IARG_THREAD_ID,
+            IARG_ADDRINT, offset,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_MEMORYWRITE_SIZE,
+            IARG_END);
+    }
+}
+
+// Call from Fini.
+VOID Watch_Report()
+{
+    for (size_t i = 0; i < g_watches.size(); i++) {
+        WATCH* w = g_watches[i];
+        if (w->addr) fprintf(g_fpWatchLog, "[WATCH] %s (%lx, sz: %d): %llu hits\n", w->name.c_str(), w->addr, w->size, (unsigned long long)w->hits);
+        else fprintf(g_fpWatchLog, "[WATCH] %s: symbol not found\n", w->name.c_str());
+    }
+}
+
+#endif // CS6501_WATCH_H
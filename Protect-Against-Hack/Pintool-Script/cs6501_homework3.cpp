@@ -9,6 +9,16 @@
 
 #include "pin.H"
 #include <iostream>
+#include "cs6501_binlog.h"
+#include "cs6501_hitcount.h"
+#include "cs6501_disasm.h"
+#include "cs6501_stack.h"
+#include "cs6501_sample.h"
+#include "cs6501_report.h"
+#include "cs6501_watch.h"
+#include "cs6501_replay.h"
+#include "cs6501_fastforward.h"
+#include "cs6501_jitstats.h"
 using std::cerr;
 using std::endl;
 
@@ -16,7 +26,7 @@ using namespace std;
 
 ADDRINT g_addrLow, g_addrHigh;
 BOOL g_bMainExecLoaded = FALSE;
-unsigned short g_accessMap[0xFFFF];
+UINT8 g_labelIsOver, g_labelCollision;  // binary trace labels for the Naive variants
 
 FILE* g_fpLog = 0;
 void log_init()
@@ -38,9 +48,12 @@ void log(const char * format, ...)
 
 VOID ImageLoad(IMG img, VOID *v)
 {
+    Watch_ImageLoad(img);
+
     if( IMG_IsMainExecutable(img) ) {
         g_addrLow = IMG_LowAddress(img); 
         g_addrHigh = IMG_HighAddress(img);
+        HitCount_SetImage(g_addrLow, g_addrHigh);
         
         // Use the above addresses to prune out non-interesting instructions.
         g_bMainExecLoaded = TRUE;
@@ -83,12 +96,11 @@ INT32 Usage()
 
 VOID docount() { ins_count++; }
 
-int IsStackMem_Heuristic(ADDRINT rsp, ADDRINT mem)
+// If-routine: small enough for Pin to inline, so the common "not interesting"
+// case costs a few instructions and the Then-routine is only called on a hit.
+ADDRINT PIN_FAST_ANALYSIS_CALL IsWatched_Naive2(ADDRINT addr)
 {
-    if( (rsp - 0x10000) < mem && mem < (rsp + 0x10000) ) {
-        return 1;
-    }
-    return 0;
+    return addr == (ADDRINT)0x7fffffffd84c;     // collision
 }
 
 void LogData(VOID* addr, UINT32 size)
@@ -132,30 +144,48 @@ VOID EveryInst(ADDRINT ip,
 }
 
 // ***** Call-Back Function ***** //
-VOID RecordMemWriteAfter(VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+VOID RecordMemWriteAfter(THREADID tid, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
 {
     //ADDRINT* ipData = (ADDRINT*)ip;
     ADDRINT offset = (ADDRINT)ip - g_addrLow;
 
-    if (IsStackMem_Heuristic(*regRSP, (ADDRINT)addr)) return;   // If goes to stack memory, skip
+    // Stack writes are filtered out by the Stack_InsertIfCall / Sample_InsertIfCall
+    // If-call, except in the -stack_keep frames
 
-    g_accessMap[offset]++;
+    UINT64 hitcount = HitCount_Inc(tid, offset);
+
+    if (BinLog_Enabled()) {
+        BinLog_MemWrite(tid, offset, addr, size, *regRSP, hitcount);
+        return;
+    }
 
     //log("[MEMWRITE(AFTER)] %p (stack: %p) -> ", offset, *regRSP);
-    log("[MEMWRITE(AFTER)] %p (hitcount: %d), mem: %p (sz: %d) (stack: %p) -> ", offset, g_accessMap[offset], addr, size, *regRSP);
+    log("[MEMWRITE(AFTER)] %p (hitcount: %llu), mem: %p (sz: %d) (stack: %p) -> ", offset, hitcount, addr, size, *regRSP);
 
     LogData(addr, size);
 }
 
-VOID RecordMemWriteAfter_Naive(VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+// Then-call of the sampled hit map: each call stands for about -sample N stores.
+VOID RecordMemWriteAfter_Sampled(THREADID tid, SAMPLE_THREAD* st, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+{
+    Sample_Rearm(st);
+    RecordMemWriteAfter(tid, ip, addr, size, regRSP);
+}
+
+VOID RecordMemWriteAfter_Naive(THREADID tid, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
 {
     ADDRINT offset = (ADDRINT)ip - g_addrLow;
 
     // isOver
     if ((ADDRINT)0x7fffffffd824 == (ADDRINT)addr) {
+        if (BinLog_Enabled()) {
+            BinLog_MemWriteNamed(tid, g_labelIsOver, offset, addr, size);
+        }
+        else {
             log("[MEMWRITE] isOver %p mem: %p (sz: %d) -> ", 
-        offset, addr, size);
-        LogData(addr, size);
+            offset, addr, size);
+            LogData(addr, size);
+        }
 
         // set to zero (force)
         memset(addr, 0, size);
@@ -163,9 +193,14 @@ VOID RecordMemWriteAfter_Naive(VOID * ip, VOID * addr, UINT32 size, ADDRINT* reg
 
     // collision
     if ((ADDRINT)0x7fffffffd85c == (ADDRINT)addr) {
-        log("[MEMWRITE] collision %p mem: %p (sz: %d) -> ", 
-        offset, addr, size);
-        LogData(addr, size);
+        if (BinLog_Enabled()) {
+            BinLog_MemWriteNamed(tid, g_labelCollision, offset, addr, size);
+        }
+        else {
+            log("[MEMWRITE] collision %p mem: %p (sz: %d) -> ", 
+            offset, addr, size);
+            LogData(addr, size);
+        }
 
         // set to zero (force)
         memset(addr, 0, size);
@@ -182,31 +217,40 @@ VOID RecordMemWriteAfter_Naive(VOID * ip, VOID * addr, UINT32 size, ADDRINT* reg
     // }
 }
 
-VOID RecordMemWriteAfter_Naive2(VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+VOID RecordMemWriteAfter_Naive2(THREADID tid, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
 {
     ADDRINT offset = (ADDRINT)ip - g_addrLow;
 
     // collision
     if ((ADDRINT)0x7fffffffd84c == (ADDRINT)addr) {
-        log("[MEMWRITE] collision %p mem: %p (sz: %d) -> ", 
-        offset, addr, size);
-        LogData(addr, size);
+        if (BinLog_Enabled()) {
+            BinLog_MemWriteNamed(tid, g_labelCollision, offset, addr, size);
+        }
+        else {
+            log("[MEMWRITE] collision %p mem: %p (sz: %d) -> ", 
+            offset, addr, size);
+            LogData(addr, size);
+        }
 
         // set to zero (force)
         memset(addr, 0, size);
     }
 }
 
-VOID RecordMemWriteAfter_Profile(VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
+VOID RecordMemWriteAfter_Profile(THREADID tid, VOID * ip, VOID * addr, UINT32 size, ADDRINT* regRSP)
 {
     //ADDRINT* ipData = (ADDRINT*)ip;
     ADDRINT offset = (ADDRINT)ip - g_addrLow;
     
-    //if (IsStackMem_Heuristic(*regRSP, (ADDRINT)addr)) return;   // If goes to stack memory, skip
-    //g_accessMap[offset]++;
+    //HitCount_Inc(tid, offset);
+
+    if (BinLog_Enabled()) {
+        BinLog_MemWrite(tid, offset, addr, size, *regRSP, HitCount_Get(tid, offset));
+        return;
+    }
 
     //log("[MEMWRITE(AFTER)] %p (stack: %p) -> ", offset, *regRSP);
-    log("[MEMWRITE(AFTER)] %p (hitcount: %d), mem: %p (sz: %d) (stack: %p) -> ", offset, g_accessMap[offset], addr, size, *regRSP);
+    log("[MEMWRITE(AFTER)] %p (hitcount: %llu), mem: %p (sz: %d) (stack: %p) -> ", offset, HitCount_Get(tid, offset), addr, size, *regRSP);
 
     LogData(addr, size);
 }
@@ -214,20 +258,46 @@ VOID RecordMemWriteAfter_Profile(VOID * ip, VOID * addr, UINT32 size, ADDRINT* r
 
 VOID Instruction(INS ins, VOID* v) { 
 
-    string strInst = INS_Disassemble(ins);  // instructions
     ADDRINT addr = INS_Address(ins);
 
     // Only print main execution instructions (skip lib's)
     if (g_bMainExecLoaded) {
         if (g_addrLow <= addr && addr < g_addrHigh) {
+            ADDRINT offset = addr - g_addrLow;
 
-            //fprintf( DBG_LOG, "[Read/Parse/Translate] [%lx] %s\n", offset, strInst.c_str());
-
-            const char* pszInst = strInst.c_str();
-            if (strstr(pszInst, "push r") == pszInst) {
+            if (IsPushInst(ins)) {
+                Disasm_LogTranslate(DBG_LOG, ins, offset, FALSE);
                 return;
             }
 
+            BOOL instrumented = FALSE;
+            if (Watch_Enabled() && INS_IsValidForIpointAfter(ins) == TRUE && INS_IsMemoryWrite(ins) == TRUE) {
+                Watch_InstrumentIns(ins, offset);
+                instrumented = TRUE;
+            }
+            if (FF_Active() && Sample_Enabled() && INS_IsValidForIpointAfter(ins) == TRUE && INS_IsCall(ins) == FALSE && INS_IsMemoryWrite(ins) == TRUE) {
+                // Sampled hit map over every non-stack store
+                UINT32 memOperands = INS_MemoryOperandCount(ins);
+                for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+                    if (INS_OperandIsImplicit(ins, memOp)) {
+                        continue;
+                    }
+                    if (INS_MemoryOperandIsWritten(ins, memOp))
+                    {
+                        Sample_InsertIfCall(ins, IPOINT_AFTER, memOp);
+                        INS_InsertThenCall(
+                            ins, IPOINT_AFTER, (AFUNPTR)RecordMemWriteAfter_Sampled,
+                            IARG_THREAD_ID,
+                            IARG_REG_VALUE, Sample_Reg(),
+                            IARG_INST_PTR,
+                            IARG_MEMORYOP_EA, memOp,
+                            IARG_MEMORYWRITE_SIZE,
+                            IARG_REG_REFERENCE, REG_RSP,
+                            IARG_END);
+                        instrumented = TRUE;
+                    }
+                }
+            }
 #if 0
             if (INS_IsValidForIpointAfter(ins) == TRUE && INS_IsCall(ins) == FALSE && INS_IsMemoryWrite(ins) == TRUE) {
                 UINT32 memOperands = INS_MemoryOperandCount(ins);
@@ -238,22 +308,29 @@ VOID Instruction(INS ins, VOID* v) {
                     }
                     if (INS_MemoryOperandIsWritten(ins, memOp))
                     {
-                        INS_InsertCall(
+                        // IsWatched_Naive2 + RecordMemWriteAfter_Naive2 for collision
+                        INS_InsertIfCall(
+                            ins, IPOINT_AFTER, (AFUNPTR)IsWatched_Naive2, IARG_FAST_ANALYSIS_CALL,
+                            IARG_MEMORYOP_EA, memOp,
+                            IARG_END);
+                        INS_InsertThenCall(
                             ins, IPOINT_AFTER, (AFUNPTR)RecordMemWriteAfter_Naive2,
+                            IARG_THREAD_ID,
                             IARG_INST_PTR,
                             IARG_MEMORYOP_EA, memOp,
                             IARG_MEMORYWRITE_SIZE,
                             IARG_REG_REFERENCE, REG_RSP,
                             IARG_END);
+                        instrumented = TRUE;
                     }
                 }
             }
 #endif
 #if 1   // Profile
-            ADDRINT offset = addr - g_addrLow;
-            if //(offset == 0x1ca9) { 
-                //(offset == 0x1d6e) {
-                (offset == 0x1c5d || offset == 0x1d92) {
+            if (FF_Active() &&
+                //(offset == 0x1ca9)) { 
+                //(offset == 0x1d6e)) {
+                (offset == 0x1c5d || offset == 0x1d92)) {
                 UINT32 memOperands = INS_MemoryOperandCount(ins);
                 // Iterate over each memory operand of the instruction
                 for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
@@ -264,15 +341,19 @@ VOID Instruction(INS ins, VOID* v) {
                     {
                         INS_InsertCall(
                             ins, IPOINT_AFTER, (AFUNPTR)RecordMemWriteAfter_Profile,
+                            IARG_THREAD_ID,
                             IARG_INST_PTR,
                             IARG_MEMORYOP_EA, memOp,
                             IARG_MEMORYWRITE_SIZE,
                             IARG_REG_REFERENCE, REG_RSP,
                             IARG_END);
+                        instrumented = TRUE;
                     }
                 }
             }
 #endif
+            if (instrumented) Report_Symbolize(ins, offset);
+            Disasm_LogTranslate(DBG_LOG, ins, offset, instrumented);
         }
     }
 }
@@ -282,11 +363,16 @@ VOID Instruction(INS ins, VOID* v) {
 VOID Fini(INT32 code, VOID* v) 
 {
     // Will execute at final stage
-    for (int i=0; i<0xFFFF; i++) {
-        if (g_accessMap[i]) {
-            log("offset: %x, max-hitcount: %d\n", i, g_accessMap[i]);
-        }
+    const UINT64* hitcount = HitCount_Merge();
+    if (Sample_Enabled()) {
+        Sample_Report(DBG_LOG, hitcount, HitCount_Size());
+    }
+    else {
+        Report_TopN(DBG_LOG, hitcount, HitCount_Size(), "max-hitcount");
     }
+    Watch_Report();
+    FF_Report();
+    JitStats_Report(DBG_LOG);
 }
 
 /* ===================================================================== */
@@ -299,10 +385,28 @@ int main(int argc, char* argv[])
     {
         return Usage();
     }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+    JitStats_Init();
 
+    PIN_InitSymbols();
     DBG_LOG = fopen("log.txt", "wt");
+    BinLog_Init();
+    HitCount_Init();
+    if (!Stack_Init() || !Sample_Init())
+    {
+        return Usage();
+    }
+    g_labelIsOver = BinLog_DefineLabel("isOver");
+    g_labelCollision = BinLog_DefineLabel("collision");
+    if (!Watch_Init(DBG_LOG) || !FF_Init(DBG_LOG))
+    {
+        return Usage();
+    }
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    JitStats_AddInsFunction(Instruction, "Instruction");
     PIN_AddFiniFunction(Fini, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
 
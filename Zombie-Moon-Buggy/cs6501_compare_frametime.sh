@@ -0,0 +1,6 @@
+# Play one session under each tool, then print the frame times side by side.
+GAME=/mnt/c/Users/Surface/Desktop/UVA/SoftwareSecurity/CS-6501-Software-Security-via-Program-Analysis/Zombie-Moon-Buggy/moon-buggy-master/moon-buggy-org
+rm -f frametime.txt
+pin -t ./obj-intel64/cs6501_proj1.so -- $GAME
+pin -t ./obj-intel64/cs6501_moon-buggy_probe.so -- $GAME
+column -t -s, frametime.txt
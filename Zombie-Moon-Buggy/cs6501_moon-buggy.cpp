@@ -9,6 +9,14 @@
 
 #include "pin.H"
 #include <iostream>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cs6501_disasm.h"
+#include "cs6501_patchspec.h"
+#include "cs6501_frametime.h"
+#include "cs6501_replay.h"
+#include "cs6501_jitstats.h"
 using std::cerr;
 using std::endl;
 
@@ -20,6 +28,106 @@ FILE* g_fpLog = 0;
 
 #define DBG_LOG g_fpLog
 
+// A patch spec resolved against the loaded main image.
+struct PATCH {
+    const PATCH_SPEC* spec;
+    REG reg;            // PATCH_SETREG
+    ADDRINT target;     // PATCH_JUMP / PATCH_NOP (end of the run), image offset
+};
+
+vector<PATCH_SPEC> g_patchSpecs;
+unordered_map<ADDRINT, PATCH> g_patches;    // by image offset, filled at ImageLoad
+
+REG PatchRegByName(const string& name)
+{
+    static const struct { const char* name; REG reg; } regs[] = {
+        { "rax", REG_RAX }, { "rbx", REG_RBX }, { "rcx", REG_RCX }, { "rdx", REG_RDX },
+        { "rsi", REG_RSI }, { "rdi", REG_RDI }, { "rbp", REG_RBP }, { "r8",  REG_R8  },
+        { "r9",  REG_R9  }, { "r10", REG_R10 }, { "r11", REG_R11 }, { "r12", REG_R12 },
+        { "r13", REG_R13 }, { "r14", REG_R14 }, { "r15", REG_R15 },
+        // 32-bit names: writing the full register zero-extends like a 32-bit mov
+        { "eax", REG_RAX }, { "ebx", REG_RBX }, { "ecx", REG_RCX }, { "edx", REG_RDX },
+        { "esi", REG_RSI }, { "edi", REG_RDI },
+    };
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+        if (name == regs[i].name) return regs[i].reg;
+    }
+    return REG_INVALID();
+}
+
+BOOL ResolvePatchLoc(IMG img, const PATCH_LOC& loc, ADDRINT* offset)
+{
+    if (loc.symbol.empty()) {
+        *offset = loc.offset;
+        return TRUE;
+    }
+    RTN rtn = RTN_FindByName(img, loc.symbol.c_str());
+    if (!RTN_Valid(rtn)) return FALSE;
+    *offset = RTN_Address(rtn) - IMG_LowAddress(img) + loc.offset;
+    return TRUE;
+}
+
+// Byte form of a patch, written before any code of the image has been translated,
+// so the JIT only ever sees the patched instruction.
+BOOL WritePatchBytes(ADDRINT addr, const vector<uint8_t>& bytes)
+{
+    ADDRINT pageSize = getpagesize();
+    ADDRINT first = addr & ~(pageSize - 1);
+    size_t len = addr + bytes.size() - first;
+
+    if (mprotect((VOID*)first, len, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) return FALSE;
+    size_t copied = PIN_SafeCopy((VOID*)addr, &bytes[0], bytes.size());
+    mprotect((VOID*)first, len, PROT_READ | PROT_EXEC);
+    return copied == bytes.size();
+}
+
+VOID ResolvePatches(IMG img)
+{
+    for (size_t i = 0; i < g_patchSpecs.size(); i++) {
+        const PATCH_SPEC& spec = g_patchSpecs[i];
+        PATCH patch;
+        ADDRINT offset;
+
+        patch.spec = &spec;
+        patch.reg = REG_INVALID();
+        patch.target = 0;
+        if (!ResolvePatchLoc(img, spec.where, &offset) ||
+            (spec.action == PATCH_JUMP && !ResolvePatchLoc(img, spec.target, &patch.target))) {
+            fprintf(DBG_LOG, "[PATCH] line %d: symbol not found in main image, skipped\n", spec.line);
+            continue;
+        }
+        if (spec.action == PATCH_SETREG && (patch.reg = PatchRegByName(spec.reg)) == REG_INVALID()) {
+            fprintf(DBG_LOG, "[PATCH] line %d: unknown register %s, skipped\n", spec.line, spec.reg.c_str());
+            continue;
+        }
+        if (!spec.expect.empty()) {
+            vector<uint8_t> orig(spec.expect.size());
+            PIN_SafeCopy(&orig[0], (VOID*)(g_addrLow + offset), orig.size());
+            if (orig != spec.expect) {
+                fprintf(DBG_LOG, "[PATCH] line %d: bytes at offset %lx differ from expect, skipped\n", spec.line, offset);
+                continue;
+            }
+        }
+        if (spec.action == PATCH_NOP) {
+            patch.target = offset + spec.length;    // same effect as running the NOPs
+        }
+        if (spec.action == PATCH_IMM) {
+            vector<uint8_t> bytes;
+            PatchSpec_Encode(spec, offset, 0, bytes);
+            bytes.erase(bytes.begin(), bytes.begin() + spec.pos);
+            if (!WritePatchBytes(g_addrLow + offset + spec.pos, bytes)) {
+                fprintf(DBG_LOG, "[PATCH] line %d: cannot write offset %lx, skipped\n", spec.line, offset);
+            }
+            else {
+                fprintf(DBG_LOG, "[PATCH] line %d -> offset %lx (immediate rewritten)\n", spec.line, offset);
+            }
+            continue;
+        }
+        g_patches[offset] = patch;
+        fprintf(DBG_LOG, "[PATCH] line %d -> offset %lx\n", spec.line, offset);
+    }
+}
+
 VOID ImageLoad(IMG img, VOID *v)
 {
     if( IMG_IsMainExecutable(img) ) {
@@ -28,6 +136,8 @@ VOID ImageLoad(IMG img, VOID *v)
         
         // Use the above addresses to prune out non-interesting instructions.
         g_bMainExecLoaded = TRUE;
+        ResolvePatches(img);
+        FrameTime_Instrument(img, FALSE);
         // main execution program, which we will be interested
         fprintf(DBG_LOG, "[IMG] Main Exec.: %lx ~ %lx\n", IMG_LowAddress(img), IMG_HighAddress(img));   
     }
@@ -47,13 +157,18 @@ UINT64 ins_count = 0;
 /* Commandline Switches */
 /* ===================================================================== */
 
+#define PATCH_FILE_DEFAULT "moon-buggy.patch"
+
+KNOB<string> KnobPatchFile(KNOB_MODE_WRITEONCE, "pintool", "patch", PATCH_FILE_DEFAULT,
+    "patch spec file (see cs6501_patchspec.h); without it in the current directory, no patches");
+
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
 
 INT32 Usage()
 {
-    cerr << "This tool prints out the number of dynamic instructions executed to stderr.\n"
+    cerr << "This tool applies the patches listed in the -patch spec file to the main executable.\n"
             "\n";
 
     cerr << KNOB_BASE::StringKnobSummary();
@@ -80,102 +195,42 @@ VOID EveryInst(ADDRINT ip,
     *regRAX = 0; // new value
 }
 
-VOID ModifyReg(ADDRINT ip, 
-               ADDRINT * regRAX, 
-               ADDRINT * regRBX,
-               ADDRINT * regRCX, 
-               ADDRINT * regRDX) 
-{
-    fprintf(DBG_LOG, "[Real Execution] EAX: %lx\n", *regRAX); // read value
-    *regRAX = 0; // new value
-}
-
-VOID ModifyReg2(ADDRINT ip, 
-               ADDRINT * regRAX, 
-               ADDRINT * regRBX,
-               ADDRINT * regRCX, 
-               ADDRINT * regRDX,
-               ADDRINT * regRDI) 
-{
-    fprintf(DBG_LOG, "[Real Execution] EAX: %lx\n", *regRAX); // read value
-    *regRDI = 99999; // new value
-}
-
-VOID ModifyReg3(ADDRINT ip, 
-               ADDRINT * regRAX, 
-               ADDRINT * regRBX,
-               ADDRINT * regRCX, 
-               ADDRINT * regRDX,
-               ADDRINT * regRDI) 
+VOID SetReg(const PATCH* patch, ADDRINT* reg)
 {
-    fprintf(DBG_LOG, "[Real Execution] EAX: %lx\n", *regRAX); // read value
-    *regRDI = 4; // new value
+    fprintf(DBG_LOG, "[Real Execution] %s: %lx\n", patch->spec->reg.c_str(), *reg); // read value
+    *reg = patch->spec->value; // new value
 }
 
-
 VOID Instruction(INS ins, VOID* v) { 
 
-    string strInst = INS_Disassemble(ins);  // instructions
     ADDRINT addr = INS_Address(ins);
 
     // Only print main execution instructions (skip lib's)
     if (g_bMainExecLoaded) {
         if (g_addrLow <= addr && addr < g_addrHigh) {
-            fprintf( DBG_LOG, "[Read/Parse/Translate] [%lx] %s\n", addr - g_addrLow, strInst.c_str()); // addr - g_addrLow: relative position
-            
-            ADDRINT offset = addr - g_addrLow; 
-
-            switch (offset) {
-            case 0xa7be:    
-                // ground.c -> scroll_handler() -> ++crash_detected;
-                // a7bb:	83 c0 01             	add    $0x1,%eax
-                // a7be:	89 05 50 4b 01 00    	mov    %eax,0x14b50(%rip)        # 1f314 <crash_detected>
-                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ModifyReg, IARG_INST_PTR, 
-                    IARG_REG_REFERENCE, REG_RAX, 
-                    IARG_REG_REFERENCE, REG_RBX, 
-                    IARG_REG_REFERENCE, REG_RCX, 
-                    IARG_REG_REFERENCE, REG_RDX, 
-                    IARG_END); 
-                break;
-            case 0x94d4:    // adjust_score() in game.c
-                //     94d0:	48 83 ec 08          	sub    $0x8,%rsp
-                // score += val;
-                //     94d4:	03 3d 52 5e 01 00    	add    0x15e52(%rip),%edi        # 1f32c <score>
-                // mvwprintw (status, 0, car_base-7, "score: %-8d", score);
-                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ModifyReg2, IARG_INST_PTR, 
-                    IARG_REG_REFERENCE, REG_RAX, 
-                    IARG_REG_REFERENCE, REG_RBX, 
-                    IARG_REG_REFERENCE, REG_RCX, 
-                    IARG_REG_REFERENCE, REG_RDX, 
-                    IARG_REG_REFERENCE, REG_RDI, 
-                    IARG_END); 
+            ADDRINT offset = addr - g_addrLow; // relative position
+            unordered_map<ADDRINT, PATCH>::const_iterator it = g_patches.find(offset);
+            BOOL instrumented = (it != g_patches.end());
+
+            Disasm_LogTranslate(DBG_LOG, ins, offset, instrumented);
+            if (!instrumented) return;
+
+            const PATCH* patch = &it->second;
+            switch (patch->spec->action) {
+            case PATCH_SETREG:
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)SetReg,
+                    IARG_PTR, patch,
+                    IARG_REG_REFERENCE, patch->reg,
+                    IARG_END);
                 break;
-            case 0xb004:    // crash_check() in buggy.c
-                // b000:	f3 0f 1e fa          	endbr64 
-                // b004:	48 8b 05 9d 43 01 00 	mov    0x1439d(%rip),%rax        # 1f3a8 <state>
-                {
-                    ADDRINT target = addr - 0x04 + 0x30;
-                    INS_InsertDirectJump(ins, IPOINT_BEFORE, target);
-                }
+            case PATCH_JUMP:
+            case PATCH_NOP:
+                INS_InsertDirectJump(ins, IPOINT_BEFORE, g_addrLow + patch->target);
                 break;
-            case 0xb094:    // car_meteor_hit() in buggy.c
-                // b090:	f3 0f 1e fa          	endbr64 
-                // b094:	31 c0                	xor    %eax,%eax
-                // b111:	c3                   	ret  
-                {
-                    ADDRINT target = addr - 0xb094 + 0xb111;
-                    INS_InsertDirectJump(ins, IPOINT_BEFORE, target);
-                }
+            case PATCH_SKIP:
+                INS_Delete(ins);
                 break;
-            case 0xbc42:    // meteor_car_hit() in meteor.c
-                // bc42:	48 63 05 83 37 01 00 	movslq 0x13783(%rip),%rax
-                // bda0:	45 31 ed             	xor    %r13d,%r13d
-                {
-                    ADDRINT target = addr - 0xbc42 + 0xbda0;
-                    INS_InsertDirectJump(ins, IPOINT_BEFORE, target);
-                }
-                break;
-            default:
+            case PATCH_IMM:     // already in the image bytes
                 break;
             }
         }
@@ -184,7 +239,12 @@ VOID Instruction(INS ins, VOID* v) {
 
 /* ===================================================================== */
 
-VOID Fini(INT32 code, VOID* v) { cerr << "Count " << ins_count << endl; }
+VOID Fini(INT32 code, VOID* v)
+{
+    FrameTime_Report("jit");
+    cerr << "Count " << ins_count << endl;
+    JitStats_Report(DBG_LOG);
+}
 
 /* ===================================================================== */
 /* Main                                                                  */
@@ -192,14 +252,29 @@ VOID Fini(INT32 code, VOID* v) { cerr << "Count " << ins_count << endl; }
 
 int main(int argc, char* argv[])
 {
+    PIN_InitSymbols();
     if (PIN_Init(argc, argv))
     {
         return Usage();
     }
+    if (!Replay_Init())
+    {
+        return Usage();
+    }
+    JitStats_Init();
+    // The default spec is optional, so the tool still starts from any directory
+    if (KnobPatchFile.Value() == PATCH_FILE_DEFAULT && access(PATCH_FILE_DEFAULT, R_OK) != 0)
+    {
+        fprintf(stderr, "[PATCH] no %s in the current directory, running without patches\n", PATCH_FILE_DEFAULT);
+    }
+    else if (!PatchSpec_Load(KnobPatchFile.Value().c_str(), g_patchSpecs))
+    {
+        return Usage();
+    }
 
     DBG_LOG = fopen("log.txt", "wt");
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    JitStats_AddInsFunction(Instruction, "Instruction");
     PIN_AddFiniFunction(Fini, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
 
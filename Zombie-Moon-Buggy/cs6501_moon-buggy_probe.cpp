@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2004-2021 Intel Corporation.
+ * SPDX-License-Identifier: MIT
+ */
+
+/*! @file
+ *  Probe-mode version of cs6501_moon-buggy.cpp: the game runs natively and only
+ *  the patched routines are replaced, so there is no JIT stutter at TICK(1).
+ */
+
+#include "pin.H"
+#include <iostream>
+#include "cs6501_frametime.h"
+using std::cerr;
+using std::endl;
+
+using namespace std;
+
+FILE* g_fpLog = 0;
+
+#define DBG_LOG g_fpLog
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<INT32> KnobScore(KNOB_MODE_WRITEONCE, "pintool", "score", "99999",
+    "value passed to adjust_score() instead of the real one");
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool replaces moon-buggy's crash checks in probe mode (near-native speed).\n"
+            "\n";
+
+    cerr << KNOB_BASE::StringKnobSummary();
+
+    cerr << endl;
+
+    return -1;
+}
+
+/* ===================================================================== */
+/* Replacement Routines */
+/* ===================================================================== */
+
+// buggy.c: int crash_check(void) -- never crash into a crater
+int crash_check_replacement() { return 0; }
+
+// buggy.c: int car_meteor_hit(int x) -- never crash into a meteor
+int car_meteor_hit_replacement(int x) { return 0; }
+
+// meteor.c: int meteor_car_hit(int x0, int x1) -- landing on a meteor is harmless
+int meteor_car_hit_replacement(int x0, int x1) { return 0; }
+
+// game.c: void adjust_score(int val) -- call the original with our own val
+typedef void (*ADJUST_SCORE_FUNC)(int);
+
+void adjust_score_wrapper(ADJUST_SCORE_FUNC orig, int val)
+{
+    orig(KnobScore.Value());
+}
+
+BOOL ReplaceProbed(IMG img, const char* name, AFUNPTR replacement)
+{
+    RTN rtn = RTN_FindByName(img, name);
+    if (!RTN_Valid(rtn) || !RTN_IsSafeForProbedReplacement(rtn)) {
+        fprintf(DBG_LOG, "[PROBE] cannot replace %s\n", name);
+        return FALSE;
+    }
+    RTN_ReplaceProbed(rtn, replacement);
+    fprintf(DBG_LOG, "[PROBE] replaced %s at %lx\n", name, RTN_Address(rtn) - IMG_LowAddress(img));
+    return TRUE;
+}
+
+/* ===================================================================== */
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if( !IMG_IsMainExecutable(img) ) return;
+
+    fprintf(DBG_LOG, "[IMG] Main Exec.: %lx ~ %lx\n", IMG_LowAddress(img), IMG_HighAddress(img));
+
+    ReplaceProbed(img, "crash_check", (AFUNPTR)crash_check_replacement);
+    ReplaceProbed(img, "car_meteor_hit", (AFUNPTR)car_meteor_hit_replacement);
+    ReplaceProbed(img, "meteor_car_hit", (AFUNPTR)meteor_car_hit_replacement);
+
+    RTN rtn = RTN_FindByName(img, "adjust_score");
+    if (RTN_Valid(rtn) && RTN_IsSafeForProbedReplacement(rtn)) {
+        PROTO proto = PROTO_Allocate(PIN_PARG(void), CALLINGSTD_DEFAULT, "adjust_score",
+            PIN_PARG(int), PIN_PARG_END());
+        RTN_ReplaceSignatureProbed(rtn, (AFUNPTR)adjust_score_wrapper,
+            IARG_PROTOTYPE, proto,
+            IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_END);
+        PROTO_Free(proto);
+        fprintf(DBG_LOG, "[PROBE] wrapped adjust_score\n");
+    }
+    else {
+        fprintf(DBG_LOG, "[PROBE] cannot wrap adjust_score\n");
+    }
+
+    FrameTime_Instrument(img, TRUE);
+    fflush(DBG_LOG);
+}
+
+/* ===================================================================== */
+
+VOID Fini(INT32 code, VOID* v)
+{
+    FrameTime_Report("probe");
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+
+    DBG_LOG = fopen("log.txt", "wt");
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgramProbed();
+
+    // nothing here will be executed
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
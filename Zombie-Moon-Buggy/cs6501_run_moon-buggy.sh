@@ -1 +1 @@
-pin -t ./obj-intel64/cs6501_proj1.so -- /mnt/c/Users/Surface/Desktop/UVA/SoftwareSecurity/CS-6501-Software-Security-via-Program-Analysis/Zombie-Moon-Buggy/moon-buggy-master/moon-buggy-org
+pin -t ./obj-intel64/cs6501_proj1.so -patch /mnt/c/Users/Surface/Desktop/UVA/SoftwareSecurity/CS-6501-Software-Security-via-Program-Analysis/Zombie-Moon-Buggy/moon-buggy.patch -- /mnt/c/Users/Surface/Desktop/UVA/SoftwareSecurity/CS-6501-Software-Security-via-Program-Analysis/Zombie-Moon-Buggy/moon-buggy-master/moon-buggy-org
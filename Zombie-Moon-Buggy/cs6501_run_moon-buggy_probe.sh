@@ -0,0 +1 @@
+pin -t ./obj-intel64/cs6501_moon-buggy_probe.so -- /mnt/c/Users/Surface/Desktop/UVA/SoftwareSecurity/CS-6501-Software-Security-via-Program-Analysis/Zombie-Moon-Buggy/moon-buggy-master/moon-buggy-org
\ No newline at end of file